@@ -2,8 +2,22 @@
 #define CAN_ID_MANAGER_H
 
 #include <array>
+#include <cstring>
+#include <utility>
 #include "isotp.h"
 
+/* Outcome of a CanLinkManager::Transact, passed to its completion callback */
+enum class IsoTpTransactResult {
+    Ok,               /* response received */
+    Timeout,          /* the deadline passed before the response was received */
+    SendFailed,       /* the request could not be sent */
+    ReceiveFailed,    /* the response reception failed */
+    ResponseTooLarge  /* the response was truncated to the response buffer */
+};
+
+/* responseSize: number of bytes written to the response buffer */
+typedef void (*IsoTpTransactCallback)(uint8_t peerCanAddr, IsoTpTransactResult result, uint16_t responseSize, void* arg);
+
 template <typename... UInt8s>
 class CanLinkManager {
 private:
@@ -15,23 +29,160 @@ private:
     static constexpr uint8_t k_numCanAddrBits_ = 5; 
     static constexpr uint8_t k_canAddrMask_ = (1 << k_numCanAddrBits_) - 1; //0x1F
     static_assert(N <= (1 << k_numCanAddrBits_));
+    static constexpr uint8_t k_noLink_ = 0xFF;
 
     uint8_t myCanAddr_;
+    std::array<uint8_t, N> peerAddrs_;
     std::array<IsoTpLink, N> isotpLinks_;
+    /* link index by the sender addr bits of a receive CAN ID */
+    std::array<uint8_t, 1 << k_numCanAddrBits_> linkFromSenderAddr_;
+
+    /* TX arbiter: links sorted by priority, deficit round-robin among equal priorities */
+    std::array<uint8_t, N> txPriority_{};
+    std::array<uint16_t, N> txQuantum_{};
+    std::array<uint32_t, N> txDeficit_{};
+    std::array<std::size_t, N> txOrder_{};
+    /* per class, indexed by its first position in txOrder_: the link whose turn it
+     * is and whether its quantum was added for this turn
+     */
+    std::array<std::size_t, N> txTurn_{};
+    std::array<bool, N> txTurnCredited_{};
+    bool txArbiterEnabled_ = false;
+    const IsoTpLink* txGranted_ = nullptr;
+    bool txAdmitted_ = false;
+    bool txBlocked_ = false;
+    /* optional bus-load cap, token bucket in bits */
+    uint32_t busLoadBitsPerSec_ = 0;
+    uint32_t busLoadBurstBits_ = 0;
+    uint32_t busLoadTokens_ = 0;
+    uint32_t busLoadLastUs_ = 0;
+    uint32_t busLoadRemainder_ = 0;
+
+    /* event callback chained by the manager's own link event handler */
+    IsoTpEventCallback userEventCb_ = nullptr;
+    void* userEventArg_ = nullptr;
+
+    /* outstanding request/response transaction per link */
+    struct Transaction {
+        bool active = false;
+        uint8_t* response = nullptr;
+        uint16_t responseSize = 0;
+        uint32_t deadline = 0;
+        IsoTpTransactCallback cb = nullptr;
+        void* arg = nullptr;
+    };
+    std::array<Transaction, N> transactions_{};
+
+    /* Negotiated payload compression. Messages of the extension start with a magic
+     * prefix and a type byte: probe and ack (followed by the version), compressed
+     * (followed by the 16 bit big endian original size and an LZ4 block) and
+     * escaped (a raw message that happens to start with the magic prefix).
+     */
+    static constexpr uint8_t k_lzMagic_[3] = {0xEC, 0x5A, 0x7C};
+    static constexpr uint8_t k_lzProbe_ = 'P';
+    static constexpr uint8_t k_lzAck_ = 'A';
+    static constexpr uint8_t k_lzCompressed_ = 'Z';
+    static constexpr uint8_t k_lzEscaped_ = 'E';
+    static constexpr uint8_t k_lzVersion_ = 1;
+    static constexpr uint16_t k_lzControlSize_ = 5;
+    static constexpr uint16_t k_lzHeaderSize_ = 6;
+    struct Compression {
+        bool enabled = false;        /* opted in on this side */
+        bool peerAccepted = false;   /* the peer probed or acked, messages may go out compressed */
+        bool probePending = false;
+        bool ackPending = false;
+        uint8_t controlSending = 0;  /* type of the probe or ack the link is sending, 0 if none */
+        uint16_t threshold = 0;
+    };
+    std::array<Compression, N> compression_{};
+    /* codec set by SetCompressionCodec, shared by all links */
+    void* codec_ = nullptr;
+    int (*codecCompress_)(void* codec, const uint8_t* src, uint16_t size, uint8_t* dst, std::size_t capacity) = nullptr;
+    int (*codecDecompress_)(const uint8_t* src, std::size_t size, uint8_t* dst, std::size_t capacity) = nullptr;
+    uint8_t* codecScratch_ = nullptr;
+    uint16_t codecScratchSize_ = 0;
+
+    /* Checkpoint layout: StateHeader, the peer addrs, then per link a LinkState
+     * followed by its buffered send and receive data
+     */
+    static constexpr uint32_t k_stateMagic_ = 0x49545043; /* "ITPC" */
+    static constexpr uint16_t k_stateVersion_ = 1;
+    struct StateHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t linkCount;
+        uint32_t savedUs;
+        uint32_t size;
+        uint8_t myCanAddr;
+        uint8_t reserved[3];
+    };
+    struct LinkState {
+        uint32_t sendArbitrationId;
+        uint32_t receiveArbitrationId;
+        /* sender */
+        uint32_t sendStMinUs;
+        uint32_t sendTimerSt;
+        uint32_t sendTimerBs;
+        int32_t sendProtocolResult;
+        uint16_t sendSize;
+        uint16_t sendOffset;
+        uint16_t sendBsRemain;
+        uint8_t sendSn;
+        uint8_t sendWftCount;
+        uint8_t sendStatus;
+        uint8_t reserved1;
+        /* receiver */
+        uint8_t receiveSn;
+        uint8_t receiveBsCount;
+        uint32_t receiveTimerCr;
+        int32_t receiveProtocolResult;
+        uint16_t receiveSize;
+        uint16_t receiveOffset;
+        uint8_t receiveStatus;
+        uint8_t receiveFcPending;
+        uint8_t receiveWftCount;
+        uint8_t receiveFfHeld;
+        uint8_t receiveFfHeldLen;
+        uint8_t receiveHeldFf[8];
+        /* compression handshake */
+        uint8_t compressionEnabled;
+        uint8_t compressionPeerAccepted;
+        uint16_t compressionThreshold;
+        /* bytes following the record */
+        uint16_t sendDataSize;
+        uint16_t receiveDataSize;
+    };
 
 public:
-    CanLinkManager(uint8_t myCanAddr, UInt8s... peerCanAddrs): myCanAddr_(myCanAddr) {
-        std::array<uint8_t, N> peerAddrs{peerCanAddrs...};
+    CanLinkManager(uint8_t myCanAddr, UInt8s... peerCanAddrs): myCanAddr_(myCanAddr), peerAddrs_{peerCanAddrs...} {
+        linkFromSenderAddr_.fill(k_noLink_);
         for (std::size_t idx = 0; idx < N; ++idx) {
-            isotp_init_link(&isotpLinks_[idx], MakeSendCanId(peerAddrs[idx]), MakeReceiveCanId(peerAddrs[idx]));
+            uint8_t& entry = linkFromSenderAddr_[peerAddrs_[idx] & k_canAddrMask_];
+            if (k_noLink_ == entry) {
+                entry = static_cast<uint8_t>(idx);
+            }
+            isotp_init_link(&isotpLinks_[idx], MakeSendCanId(peerAddrs_[idx]), MakeReceiveCanId(peerAddrs_[idx]));
+            txQuantum_[idx] = 1;
+            txOrder_[idx] = idx;
+            isotp_config_event_cb(&isotpLinks_[idx], &CanLinkManager::OnLinkEvent, this);
         }
     }
 
+    /* the links keep a pointer to the manager */
+    CanLinkManager(const CanLinkManager&) = delete;
+    CanLinkManager& operator=(const CanLinkManager&) = delete;
+
     std::array<IsoTpLink, N>& GetIsotpLinks() {return isotpLinks_;}
 
     IsoTpLink* GetLinkFromReceiveCanId(uint16_t receiveCanId) {
+        uint8_t idx = LinkIndexFromReceiveCanId(receiveCanId);
+
+        return k_noLink_ == idx ? nullptr : &isotpLinks_[idx];
+    }
+
+    IsoTpLink* GetLinkFromPeerAddr(uint8_t peerCanAddr) {
         for (std::size_t idx = 0; idx < N; ++idx) {
-            if (isotpLinks_[idx].receive_arbitration_id == receiveCanId) {
+            if (peerAddrs_[idx] == peerCanAddr) {
                 return &isotpLinks_[idx];
             }
         }
@@ -39,12 +190,879 @@ public:
         return nullptr;
     }
 
+    /* Sends the same payload to several peers, all of them if peerCanAddrs is
+     * nullptr. The payload is encoded once into frames, which all links send from,
+     * the CAN ID comes from each link and flow control is tracked per link. frames
+     * needs ISOTP_ENCODED_FRAME_COUNT(size) entries and must stay unchanged until
+     * LinksSending(frames) is 0. Busy links and unknown peers are skipped.
+     * Without peerCanAddrs, numPeers limits the send to the first numPeers links (at most N).
+     * Return the number of links the send was started on
+     */
+    std::size_t Multicast(const uint8_t* payload, uint16_t size, IsoTpCanFrame* frames, uint16_t maxFrames,
+                          const uint8_t* peerCanAddrs = nullptr, std::size_t numPeers = N) {
+        int count = isotp_encode_frames(payload, size, frames, maxFrames);
+        std::size_t started = 0;
+
+        if (count <= 0) {
+            return 0;
+        }
+        if (nullptr == peerCanAddrs && numPeers > N) {
+            numPeers = N;
+        }
+        for (std::size_t i = 0; i < numPeers; ++i) {
+            IsoTpLink* link = nullptr == peerCanAddrs ? &isotpLinks_[i] : GetLinkFromPeerAddr(peerCanAddrs[i]);
+            if (nullptr != link && ISOTP_SEND_STATUS_IDLE == link->send_status &&
+                1 == isotp_send_encoded(link, frames, static_cast<uint16_t>(count))) {
+                ++started;
+            }
+        }
+        return started;
+    }
+
+    /* Number of links still sending from frames, see Multicast */
+    std::size_t LinksSending(const IsoTpCanFrame* frames) const {
+        std::size_t sending = 0;
+
+        for (const auto& link : isotpLinks_) {
+            if (link.send_frames == frames && ISOTP_SEND_STATUS_INPROGRESS == link.send_status) {
+                ++sending;
+            }
+        }
+        return sending;
+    }
+
+    /* Interrupt side of the two stage receive, the links need a frame ring set up
+     * with isotp_config_rx_ring. Only queues the frame, ProcessRx or Poll handles it.
+     * Return ISOTP_RET_OK if queued, ISOTP_RET_OVERFLOW if the ring was full,
+     * ISOTP_RET_LENGTH if len is out of range, or ISOTP_RET_ERROR if the frame
+     * is not addressed to this node
+     */
+    int OnCanMessageIsr(uint32_t canId, const uint8_t* data, uint8_t len) {
+        uint8_t idx = LinkIndexFromReceiveCanId(canId);
+
+        if (k_noLink_ == idx || nullptr == isotpLinks_[idx].rx_ring) {
+            return ISOTP_RET_ERROR;
+        }
+        return isotp_on_can_message_isr(&isotpLinks_[idx], data, len);
+    }
+
+    /* Task side of the two stage receive, handles the queued frames and sends the
+     * flow control and the frames released by flow control.
+     * Return 1 if need to start timer for Poll, else 0
+     */
+    int ProcessRx() {
+        int needStartPoll = 0;
+
+        for (auto& link : isotpLinks_) {
+            needStartPoll |= isotp_process_rx(&link);
+        }
+        OnTxComplete();
+        return needStartPoll;
+    }
+
+    /* Registers one callback for the RX complete, TX complete and protocol error
+     * events of all links, the link is passed to the callback. Events of a link
+     * with an outstanding transaction are consumed by the transaction.
+     */
+    void SetEventCallback(IsoTpEventCallback cb, void* arg) {
+        userEventCb_ = cb;
+        userEventArg_ = arg;
+    }
+
+    /* Sends a request to the peer and completes with its response. The response
+     * is expected on the same link any time after the first frame of the request
+     * went out, so a response that overtakes the end of the request is not lost.
+     * Messages completed before go to the event callback as outside a transaction
+     * and are dropped if it doesn't read them. The callback is called exactly
+     * once, from within Poll, the CAN message handling or this call, with the
+     * result and the response size. deadlineUs is an absolute isotp_user_get_us time.
+     * One transaction per peer can be outstanding, the peers are independent.
+     * Return false without calling the callback if the peer is unknown or its link is busy.
+     */
+    bool Transact(uint8_t peerCanAddr, const uint8_t* request, uint16_t requestSize,
+                  uint8_t* response, uint16_t responseSize, uint32_t deadlineUs,
+                  IsoTpTransactCallback cb, void* arg) {
+        IsoTpLink* link = GetLinkFromPeerAddr(peerCanAddr);
+        if (nullptr == link) {
+            return false;
+        }
+        std::size_t idx = link - isotpLinks_.data();
+        Transaction& transaction = transactions_[idx];
+        /* an unread message would be taken for the response */
+        if (transaction.active || ISOTP_SEND_STATUS_IDLE != link->send_status ||
+            ISOTP_RECEIVE_STATUS_IDLE != link->receive_status) {
+            return false;
+        }
+
+        /* armed before the first frame leaves */
+        transaction.active = true;
+        transaction.response = response;
+        transaction.responseSize = responseSize;
+        transaction.deadline = deadlineUs;
+        transaction.cb = cb;
+        transaction.arg = arg;
+        if (0 == SendMessage(idx, request, requestSize) && transaction.active) {
+            CompleteTransaction(idx, IsoTpTransactResult::SendFailed, 0);
+        }
+        return true;
+    }
+
+    /* Gives the manager the payload codec for EnableCompression, e.g. an IsoTpLz<>
+     * from isotp_lz.hpp; a manager that never gets one carries no codec. Codec needs
+     * int Compress(const uint8_t*, uint16_t, uint8_t*, std::size_t), returning 0 if
+     * the output does not fit, and static int Decompress(const uint8_t*, std::size_t,
+     * uint8_t*, std::size_t), returning -1 for a malformed block. Both must stay valid
+     * while the manager uses them. scratch holds a compressed message until isotp_send
+     * copied it, so it needs the largest send buffer size of the links.
+     */
+    template <typename Codec>
+    void SetCompressionCodec(Codec& codec, uint8_t* scratch, uint16_t scratchSize) {
+        codec_ = &codec;
+        codecCompress_ = &CompressWith<Codec>;
+        codecDecompress_ = &Codec::Decompress;
+        codecScratch_ = scratch;
+        codecScratchSize_ = scratchSize;
+    }
+
+    /* Opts the link to the peer in to payload compression. A probe tells the peer,
+     * which answers with an ack if it opted in too, from then on Send compresses
+     * messages of at least threshold bytes that get smaller. Peers that never
+     * answer keep getting raw messages, but see the probe as a 5 byte message.
+     * On an opted in link, a raw 5 byte message that looks like a probe or ack
+     * (0xEC 0x5A 0x7C, 'P' or 'A', version 1) is taken for one, and messages sent
+     * starting with 0xEC 0x5A 0x7C go out escaped from the start of the handshake.
+     * Return false if the peer is unknown or SetCompressionCodec was not called
+     */
+    bool EnableCompression(uint8_t peerCanAddr, uint16_t threshold) {
+        IsoTpLink* link = GetLinkFromPeerAddr(peerCanAddr);
+        if (nullptr == link || nullptr == codec_) {
+            return false;
+        }
+        std::size_t idx = link - isotpLinks_.data();
+        Compression& compression = compression_[idx];
+
+        compression.enabled = true;
+        compression.threshold = threshold;
+        compression.probePending = !compression.peerAccepted;
+        SendCompressionControl(idx);
+        return true;
+    }
+
+    /* true once messages to the peer may go out compressed */
+    bool IsCompressionActive(uint8_t peerCanAddr) {
+        IsoTpLink* link = GetLinkFromPeerAddr(peerCanAddr);
+        return nullptr != link && compression_[link - isotpLinks_.data()].peerAccepted;
+    }
+
+    /* isotp_send to the peer, compressing the payload if negotiated.
+     * Return 1 on success, 0 if the peer is unknown, the link is busy or the message too large
+     */
+    int Send(uint8_t peerCanAddr, const uint8_t* payload, uint16_t size) {
+        IsoTpLink* link = GetLinkFromPeerAddr(peerCanAddr);
+        if (nullptr == link) {
+            return 0;
+        }
+        return SendMessage(link - isotpLinks_.data(), payload, size);
+    }
+
+    /* isotp_receive from the peer, decompressing the message if needed. Probes and acks
+     * are handled here and not returned; with an event callback set they never reach it.
+     * Return ISOTP_RET_OK, ISOTP_RET_NO_DATA, or ISOTP_RET_ERROR if the peer is unknown
+     * or a compressed message is corrupt (the message is dropped)
+     */
+    int Receive(uint8_t peerCanAddr, uint8_t* payload, uint16_t size, uint16_t* outSize) {
+        IsoTpLink* link = GetLinkFromPeerAddr(peerCanAddr);
+        if (nullptr == link) {
+            return ISOTP_RET_ERROR;
+        }
+        return ReceiveMessage(link - isotpLinks_.data(), payload, size, outSize);
+    }
+
+    /* Upper bound of the checkpoint size, see SaveState */
+    std::size_t StateSize() const {
+        std::size_t size = sizeof(StateHeader) + N;
+
+        for (const auto& link : isotpLinks_) {
+            size += sizeof(LinkState) + link.send_buf_size + link.receive_buf_size;
+        }
+        return size;
+    }
+
+    /* Writes the state of all links, including the partly sent and received
+     * messages, into region, so a restarted process can continue the transfers
+     * with RestoreState within the peers' N_Bs/N_Cr timeouts. That only works for
+     * a transfer nothing arrives for while the process is down: a receiver in the
+     * middle of a block misses the consecutive frames sent meanwhile and fails
+     * with WRONG_SN, a sender waiting for flow control misses it and fails with
+     * N_Bs. Call it as the last
+     * thing before exiting, after Poll; the frames still in a link's rx ring and
+     * the outstanding transactions are not saved. Streaming and pre-encoded sends
+     * and streaming receives depend on the process and are not resumed.
+     * Return the bytes written, or 0 if region is smaller than StateSize()
+     */
+    std::size_t SaveState(uint8_t* region, std::size_t size) const {
+        StateHeader header{};
+        std::size_t offset = sizeof(StateHeader) + N;
+
+        if (size < StateSize()) {
+            return 0;
+        }
+        for (std::size_t idx = 0; idx < N; ++idx) {
+            const IsoTpLink& link = isotpLinks_[idx];
+            LinkState state = SaveLinkState(idx);
+
+            std::memcpy(region + offset, &state, sizeof(state));
+            offset += sizeof(state);
+            if (0 != state.sendDataSize) {
+                std::memcpy(region + offset, link.send_buffer, state.sendDataSize);
+                offset += state.sendDataSize;
+            }
+            if (0 != state.receiveDataSize) {
+                std::memcpy(region + offset, link.receive_buffer, state.receiveDataSize);
+                offset += state.receiveDataSize;
+            }
+        }
+
+        header.magic = k_stateMagic_;
+        header.version = k_stateVersion_;
+        header.linkCount = N;
+        header.savedUs = isotp_user_get_us();
+        header.size = static_cast<uint32_t>(offset);
+        header.myCanAddr = myCanAddr_;
+        std::memcpy(region, &header, sizeof(header));
+        std::memcpy(region + sizeof(header), peerAddrs_.data(), N);
+        return offset;
+    }
+
+    /* Resumes the link states saved by SaveState. The links keep their buffers and
+     * callbacks, so configure them first, and call SetCompressionCodec (not
+     * EnableCompression) to keep the negotiated compression. isotp_user_get_us has to be a clock that
+     * keeps running across the restart (e.g. CLOCK_MONOTONIC): the saved timers are
+     * absolute, so the time spent restarting counts against the timeouts.
+     * Return false without changing any link if the region was saved by a manager
+     * with other addresses, does not fit the buffers, is inconsistent, or the clock
+     * went backwards
+     */
+    bool RestoreState(const uint8_t* region, std::size_t size) {
+        StateHeader header;
+
+        if (size < sizeof(header) + N) {
+            return false;
+        }
+        std::memcpy(&header, region, sizeof(header));
+        if (k_stateMagic_ != header.magic || k_stateVersion_ != header.version || N != header.linkCount ||
+            myCanAddr_ != header.myCanAddr || header.size < sizeof(header) + N || header.size > size ||
+            0 != std::memcmp(region + sizeof(header), peerAddrs_.data(), N) ||
+            IsoTpTimeAfter(header.savedUs, isotp_user_get_us())) {
+            return false;
+        }
+
+        /* validate everything before the first link changes, no read past the saved or the mapped size */
+        std::size_t end = header.size < size ? header.size : size;
+        for (int pass = 0; pass < 2; ++pass) {
+            std::size_t offset = sizeof(header) + N;
+            for (std::size_t idx = 0; idx < N; ++idx) {
+                IsoTpLink& link = isotpLinks_[idx];
+                LinkState state;
+
+                if (end - offset < sizeof(state)) {
+                    return false;
+                }
+                std::memcpy(&state, region + offset, sizeof(state));
+                offset += sizeof(state);
+                if (end - offset < static_cast<std::size_t>(state.sendDataSize) + state.receiveDataSize ||
+                    !LinkStateFits(link, state)) {
+                    return false;
+                }
+                if (1 == pass) {
+                    RestoreLinkState(idx, state, region + offset, region + offset + state.sendDataSize);
+                }
+                offset += state.sendDataSize + state.receiveDataSize;
+            }
+        }
+        return true;
+    }
+
+    /* Releases all single, first and consecutive frames of the links through a
+     * common TX scheduler run by Poll() and OnTxComplete(). Frames of links with a
+     * higher priority class go first, links of the same class share the bus by
+     * deficit round-robin. Frames due outside the scheduler are held back and sent
+     * by the next Poll(), so isotp_send and isotp_poll may still be used on the links.
+     */
+    void EnableTxArbiter(bool enable) {
+        txArbiterEnabled_ = enable;
+        for (auto& link : isotpLinks_) {
+            isotp_config_tx_gate(&link, enable ? &CanLinkManager::TxGate : nullptr, this);
+        }
+    }
+
+    /* priority: 0 is the highest class; quantum: frames a link may send per round */
+    bool SetTxPriority(uint8_t peerCanAddr, uint8_t priority, uint16_t quantum = 1) {
+        IsoTpLink* link = GetLinkFromPeerAddr(peerCanAddr);
+        if (nullptr == link || 0 == quantum) {
+            return false;
+        }
+        std::size_t idx = link - isotpLinks_.data();
+        txPriority_[idx] = priority;
+        txQuantum_[idx] = quantum;
+        /* stable insertion sort keeps the link order within a class */
+        for (std::size_t i = 0; i < N; ++i) {
+            txOrder_[i] = i;
+        }
+        for (std::size_t i = 1; i < N; ++i) {
+            for (std::size_t j = i; j > 0 && txPriority_[txOrder_[j - 1]] > txPriority_[txOrder_[j]]; --j) {
+                std::swap(txOrder_[j - 1], txOrder_[j]);
+            }
+        }
+        txTurn_.fill(0);
+        txTurnCredited_.fill(false);
+        return true;
+    }
+
+    /* Caps the bus load of the scheduled frames, 0 bits/s removes the cap.
+     * Flow control frames are not accounted.
+     */
+    void SetBusLoadLimit(uint32_t bitsPerSec, uint32_t burstBits) {
+        busLoadBitsPerSec_ = bitsPerSec;
+        busLoadBurstBits_ = burstBits;
+        busLoadTokens_ = burstBits;
+        busLoadLastUs_ = isotp_user_get_us();
+        busLoadRemainder_ = 0;
+    }
+
+    /* Runs the TX scheduler and polls all links.
+     * Return 1 if need to stop timer for Poll, else 0
+     */
+    int Poll() {
+        int stopTimer = 1;
+        uint32_t now;
+
+        RunTxArbiter();
+        for (auto& link : isotpLinks_) {
+            stopTimer &= isotp_poll(&link);
+        }
+        for (std::size_t idx = 0; idx < N; ++idx) {
+            if (compression_[idx].probePending || compression_[idx].ackPending) {
+                SendCompressionControl(idx);
+                stopTimer = 0;
+            }
+        }
+
+        now = isotp_user_get_us();
+        for (std::size_t idx = 0; idx < N; ++idx) {
+            if (!transactions_[idx].active) {
+                continue;
+            }
+            if (IsoTpTimeAfter(now, transactions_[idx].deadline)) {
+                CompleteTransaction(idx, IsoTpTransactResult::Timeout, 0);
+            } else {
+                stopTimer = 0;
+            }
+        }
+        return stopTimer;
+    }
+
+    /* Call instead of isotp_on_tx_complete when the CAN driver has room for frames again,
+     * from the task that polls the manager; from the TX interrupt use OnTxCompleteIsr
+     */
+    void OnTxComplete() {
+        if (txArbiterEnabled_) {
+            RunTxArbiter();
+        } else {
+            for (auto& link : isotpLinks_) {
+                isotp_on_tx_complete(&link);
+            }
+        }
+    }
+
+    /* Interrupt side of OnTxComplete, flags the links for the next Poll */
+    void OnTxCompleteIsr() {
+        for (auto& link : isotpLinks_) {
+            isotp_on_tx_complete_isr(&link);
+        }
+    }
+
 private:
+    static void OnLinkEvent(IsoTpLink* link, IsoTpEventTypes event, int protocolResult, void* arg) {
+        static_cast<CanLinkManager*>(arg)->HandleLinkEvent(link, event, protocolResult);
+    }
+
+    void HandleLinkEvent(IsoTpLink* link, IsoTpEventTypes event, int protocolResult) {
+        std::size_t idx = link - isotpLinks_.data();
+        uint16_t size;
+
+        /* the compression handshake stays between the managers */
+        if (0 != compression_[idx].controlSending &&
+            (ISOTP_EVENT_SEND_COMPLETE == event || ISOTP_EVENT_SEND_ERROR == event)) {
+            Compression& compression = compression_[idx];
+            if (ISOTP_EVENT_SEND_ERROR == event) {
+                (k_lzProbe_ == compression.controlSending ? compression.probePending : compression.ackPending) = true;
+            }
+            compression.controlSending = 0;
+            SendCompressionControl(idx);
+            return;
+        }
+        if (ISOTP_EVENT_RECEIVE_COMPLETE == event && IsCompressionControl(idx)) {
+            ReceiveMessage(idx, nullptr, 0, &size);
+            return;
+        }
+
+        if (!transactions_[idx].active) {
+            if (nullptr != userEventCb_) {
+                userEventCb_(link, event, protocolResult, userEventArg_);
+            }
+            return;
+        }
+        /* nothing that arrived before the request's first frame went out can answer it */
+        if ((ISOTP_EVENT_RECEIVE_COMPLETE == event || ISOTP_EVENT_RECEIVE_ERROR == event) &&
+            ISOTP_SEND_STATUS_INPROGRESS == link->send_status && 0 == link->send_offset) {
+            if (nullptr != userEventCb_) {
+                userEventCb_(link, event, protocolResult, userEventArg_);
+            }
+            if (ISOTP_RECEIVE_STATUS_FULL == link->receive_status) {
+                uint8_t unused;
+                isotp_receive(link, &unused, 0, &size);
+            }
+            return;
+        }
+
+        switch (event) {
+            case ISOTP_EVENT_RECEIVE_COMPLETE: {
+                uint16_t messageSize = MessageSize(idx);
+                if (ISOTP_RET_OK != ReceiveMessage(idx, transactions_[idx].response, transactions_[idx].responseSize, &size)) {
+                    CompleteTransaction(idx, IsoTpTransactResult::ReceiveFailed, 0);
+                    break;
+                }
+                CompleteTransaction(idx, size < messageSize ? IsoTpTransactResult::ResponseTooLarge : IsoTpTransactResult::Ok, size);
+                break;
+            }
+            case ISOTP_EVENT_RECEIVE_ERROR:
+                /* an unexpected PDU (a stray consecutive frame, or a new single or first frame
+                 * replacing the one being received) doesn't end a response; every other receive
+                 * error ends the response whose single or first frame was accepted
+                 */
+                if (ISOTP_PROTOCOL_RESULT_UNEXP_PDU != protocolResult) {
+                    CompleteTransaction(idx, IsoTpTransactResult::ReceiveFailed, 0);
+                }
+                break;
+            case ISOTP_EVENT_SEND_ERROR:
+                CompleteTransaction(idx, IsoTpTransactResult::SendFailed, 0);
+                break;
+            default:
+                break;
+        }
+    }
+
+    /* A probe or ack of the exact size and version, or, once this side accepted the peer,
+     * a compressed or escaped message; anything else is delivered as it is
+     */
+    bool IsLzMessage(std::size_t idx) const {
+        const IsoTpLink& link = isotpLinks_[idx];
+
+        if (!compression_[idx].enabled || ISOTP_RECEIVE_STATUS_FULL != link.receive_status ||
+            link.receive_size < sizeof(k_lzMagic_) + 1 ||
+            0 != std::memcmp(link.receive_buffer, k_lzMagic_, sizeof(k_lzMagic_))) {
+            return false;
+        }
+        switch (link.receive_buffer[sizeof(k_lzMagic_)]) {
+            case k_lzProbe_:
+            case k_lzAck_:
+                return k_lzControlSize_ == link.receive_size && k_lzVersion_ == link.receive_buffer[sizeof(k_lzMagic_) + 1];
+            case k_lzCompressed_:
+                return compression_[idx].peerAccepted && link.receive_size >= k_lzHeaderSize_;
+            case k_lzEscaped_:
+                return compression_[idx].peerAccepted;
+            default:
+                return false;
+        }
+    }
+
+    bool IsCompressionControl(std::size_t idx) const {
+        if (!IsLzMessage(idx)) {
+            return false;
+        }
+        uint8_t type = isotpLinks_[idx].receive_buffer[sizeof(k_lzMagic_)];
+        return k_lzProbe_ == type || k_lzAck_ == type;
+    }
+
+    /* size of the received message as the application sees it */
+    uint16_t MessageSize(std::size_t idx) const {
+        const IsoTpLink& link = isotpLinks_[idx];
+
+        if (!IsLzMessage(idx)) {
+            return link.receive_size;
+        }
+        switch (link.receive_buffer[sizeof(k_lzMagic_)]) {
+            case k_lzCompressed_:
+                return (link.receive_buffer[4] << 8) | link.receive_buffer[5];
+            case k_lzEscaped_:
+                return link.receive_size - sizeof(k_lzMagic_) - 1;
+            default:
+                return link.receive_size;
+        }
+    }
+
+    int SendMessage(std::size_t idx, const uint8_t* payload, uint16_t size) {
+        IsoTpLink& link = isotpLinks_[idx];
+        Compression& compression = compression_[idx];
+
+        if (!compression.enabled || ISOTP_SEND_STATUS_IDLE != link.send_status) {
+            return isotp_send(&link, payload, size);
+        }
+        /* not compressed until the ack went out, the peer only decodes after seeing it */
+        if (compression.peerAccepted && !compression.ackPending && size >= compression.threshold &&
+            codecScratchSize_ > k_lzHeaderSize_) {
+            int packed = codecCompress_(codec_, payload, size, codecScratch_ + k_lzHeaderSize_, codecScratchSize_ - k_lzHeaderSize_);
+            if (packed > 0 && packed + k_lzHeaderSize_ < size) {
+                std::memcpy(codecScratch_, k_lzMagic_, sizeof(k_lzMagic_));
+                codecScratch_[3] = k_lzCompressed_;
+                codecScratch_[4] = static_cast<uint8_t>(size >> 8);
+                codecScratch_[5] = static_cast<uint8_t>(size);
+                return isotp_send(&link, codecScratch_, static_cast<uint16_t>(packed + k_lzHeaderSize_));
+            }
+        }
+        if (size >= sizeof(k_lzMagic_) && 0 == std::memcmp(payload, k_lzMagic_, sizeof(k_lzMagic_))) {
+            /* the peer would take it for a message of the extension, whether or not it saw the ack yet */
+            if (size + sizeof(k_lzMagic_) + 1 > codecScratchSize_) {
+                return 0;
+            }
+            std::memcpy(codecScratch_, k_lzMagic_, sizeof(k_lzMagic_));
+            codecScratch_[3] = k_lzEscaped_;
+            std::memcpy(codecScratch_ + sizeof(k_lzMagic_) + 1, payload, size);
+            return isotp_send(&link, codecScratch_, static_cast<uint16_t>(size + sizeof(k_lzMagic_) + 1));
+        }
+        return isotp_send(&link, payload, size);
+    }
+
+    int ReceiveMessage(std::size_t idx, uint8_t* payload, uint16_t size, uint16_t* outSize) {
+        IsoTpLink& link = isotpLinks_[idx];
+        Compression& compression = compression_[idx];
+        const uint8_t* message = link.receive_buffer;
+        uint16_t released;
+        uint8_t unused;
+        int ret = ISOTP_RET_NO_DATA;
+
+        if (!IsLzMessage(idx)) {
+            return isotp_receive(&link, payload, size, outSize);
+        }
+        *outSize = 0;
+        /* decoded straight from the receive buffer, released afterwards */
+        switch (message[sizeof(k_lzMagic_)]) {
+            case k_lzProbe_:
+            case k_lzAck_:
+                compression.peerAccepted = true;
+                compression.probePending = false;
+                compression.ackPending |= k_lzProbe_ == message[sizeof(k_lzMagic_)];
+                break;
+            case k_lzEscaped_:
+                *outSize = MessageSize(idx) < size ? MessageSize(idx) : size;
+                std::memcpy(payload, message + sizeof(k_lzMagic_) + 1, *outSize);
+                ret = ISOTP_RET_OK;
+                break;
+            default: {
+                uint16_t expected = MessageSize(idx) < size ? MessageSize(idx) : size;
+                int decoded = codecDecompress_(message + k_lzHeaderSize_, link.receive_size - k_lzHeaderSize_, payload, expected);
+                if (decoded == expected) {
+                    *outSize = expected;
+                    ret = ISOTP_RET_OK;
+                } else {
+                    ret = ISOTP_RET_ERROR;
+                }
+                break;
+            }
+        }
+        isotp_receive(&link, &unused, 0, &released);
+        SendCompressionControl(idx);
+        return ret;
+    }
+
+    template <typename Codec>
+    static int CompressWith(void* codec, const uint8_t* src, uint16_t size, uint8_t* dst, std::size_t capacity) {
+        return static_cast<Codec*>(codec)->Compress(src, size, dst, capacity);
+    }
+
+    /* Sends a pending probe or ack once the link is free */
+    void SendCompressionControl(std::size_t idx) {
+        Compression& compression = compression_[idx];
+        uint8_t message[k_lzControlSize_];
+
+        if ((!compression.probePending && !compression.ackPending) || 0 != compression.controlSending ||
+            ISOTP_SEND_STATUS_IDLE != isotpLinks_[idx].send_status) {
+            return;
+        }
+        std::memcpy(message, k_lzMagic_, sizeof(k_lzMagic_));
+        message[3] = compression.probePending ? k_lzProbe_ : k_lzAck_;
+        message[4] = k_lzVersion_;
+        bool& pending = compression.probePending ? compression.probePending : compression.ackPending;
+        /* cleared first, a single frame may complete within isotp_send */
+        pending = false;
+        compression.controlSending = message[3];
+        if (1 != isotp_send(&isotpLinks_[idx], message, sizeof(message))) {
+            pending = true;
+            compression.controlSending = 0;
+        }
+    }
+
+    LinkState SaveLinkState(std::size_t idx) const {
+        const IsoTpLink& link = isotpLinks_[idx];
+        LinkState state{};
+
+        state.sendArbitrationId = link.send_arbitration_id;
+        state.receiveArbitrationId = link.receive_arbitration_id;
+        /* a stream source or frame train lives in the process, the send can't be resumed */
+        if (ISOTP_SEND_STATUS_INPROGRESS == link.send_status &&
+            nullptr == link.send_source_cb && nullptr == link.send_frames) {
+            state.sendStMinUs = link.send_st_min_us;
+            state.sendTimerSt = link.send_timer_st;
+            state.sendTimerBs = link.send_timer_bs;
+            state.sendProtocolResult = link.send_protocol_result;
+            state.sendSize = link.send_size;
+            state.sendOffset = link.send_offset;
+            state.sendBsRemain = link.send_bs_remain;
+            state.sendSn = link.send_sn;
+            state.sendWftCount = link.send_wtf_count;
+            state.sendStatus = link.send_status;
+            state.sendDataSize = link.send_size;
+        } else {
+            state.sendStatus = ISOTP_SEND_STATUS_IDLE;
+        }
+        /* chunks already handed to a stream consumer are gone with the process */
+        if (ISOTP_RECEIVE_STATUS_IDLE != link.receive_status && nullptr == link.receive_chunk_cb) {
+            state.receiveSn = link.receive_sn;
+            state.receiveBsCount = link.receive_bs_count;
+            state.receiveTimerCr = link.receive_timer_cr;
+            state.receiveProtocolResult = link.receive_protocol_result;
+            state.receiveSize = link.receive_size;
+            state.receiveOffset = link.receive_offset;
+            state.receiveStatus = link.receive_status;
+            state.receiveFcPending = link.receive_fc_pending;
+            state.receiveWftCount = link.receive_wft_count;
+            state.receiveFfHeld = link.receive_ff_held;
+            state.receiveFfHeldLen = link.receive_ff_held_len;
+            std::memcpy(state.receiveHeldFf, &link.receive_held_ff, sizeof(state.receiveHeldFf));
+            state.receiveDataSize = ISOTP_RECEIVE_STATUS_FULL == link.receive_status ? link.receive_size : link.receive_offset;
+        } else {
+            state.receiveStatus = ISOTP_RECEIVE_STATUS_IDLE;
+        }
+        state.compressionEnabled = compression_[idx].enabled;
+        state.compressionPeerAccepted = compression_[idx].peerAccepted;
+        state.compressionThreshold = compression_[idx].threshold;
+        return state;
+    }
+
+    /* The isotp.c receive and send paths trust these fields, a state that would make
+     * them write past the link's buffers or that SaveState can't have written is refused
+     */
+    static bool LinkStateFits(const IsoTpLink& link, const LinkState& state) {
+        if (state.sendArbitrationId != link.send_arbitration_id ||
+            state.receiveArbitrationId != link.receive_arbitration_id ||
+            state.sendStatus > ISOTP_SEND_STATUS_ERROR || state.receiveStatus > ISOTP_RECEIVE_STATUS_FULL) {
+            return false;
+        }
+        if (ISOTP_SEND_STATUS_INPROGRESS == state.sendStatus) {
+            if (state.sendSize > link.send_buf_size || state.sendOffset > state.sendSize ||
+                state.sendDataSize != state.sendSize) {
+                return false;
+            }
+        } else if (0 != state.sendDataSize) {
+            return false;
+        }
+        if (ISOTP_RECEIVE_STATUS_IDLE != state.receiveStatus) {
+            /* a streaming receive is never saved, nor resumed into a streaming link */
+            if (nullptr != link.receive_chunk_cb || state.receiveSize > link.receive_buf_size ||
+                state.receiveOffset > state.receiveSize || state.receiveFfHeldLen > sizeof(state.receiveHeldFf) ||
+                state.receiveDataSize != (ISOTP_RECEIVE_STATUS_FULL == state.receiveStatus ? state.receiveSize : state.receiveOffset)) {
+                return false;
+            }
+        } else if (0 != state.receiveDataSize) {
+            return false;
+        }
+        return true;
+    }
+
+    void RestoreLinkState(std::size_t idx, const LinkState& state, const uint8_t* sendData, const uint8_t* receiveData) {
+        IsoTpLink& link = isotpLinks_[idx];
+
+        link.send_st_min_us = state.sendStMinUs;
+        link.send_timer_st = state.sendTimerSt;
+        link.send_timer_bs = state.sendTimerBs;
+        link.send_protocol_result = state.sendProtocolResult;
+        link.send_size = state.sendSize;
+        link.send_offset = state.sendOffset;
+        link.send_bs_remain = state.sendBsRemain;
+        link.send_sn = state.sendSn;
+        link.send_wtf_count = state.sendWftCount;
+        link.send_status = state.sendStatus;
+        link.send_stage_size = 0;
+        link.send_source_cb = nullptr;
+        link.send_frames = nullptr;
+        if (0 != state.sendDataSize) {
+            std::memcpy(link.send_buffer, sendData, state.sendDataSize);
+        }
+
+        link.receive_sn = state.receiveSn;
+        link.receive_bs_count = state.receiveBsCount;
+        link.receive_timer_cr = state.receiveTimerCr;
+        link.receive_protocol_result = state.receiveProtocolResult;
+        link.receive_size = state.receiveSize;
+        link.receive_offset = state.receiveOffset;
+        link.receive_stage_size = 0;
+        link.receive_status = state.receiveStatus;
+        link.receive_fc_pending = state.receiveFcPending;
+        link.receive_wft_count = state.receiveWftCount;
+        link.receive_ff_held = state.receiveFfHeld;
+        link.receive_ff_held_len = state.receiveFfHeldLen;
+        std::memcpy(&link.receive_held_ff, state.receiveHeldFf, sizeof(state.receiveHeldFf));
+        if (0 != state.receiveDataSize) {
+            std::memcpy(link.receive_buffer, receiveData, state.receiveDataSize);
+        }
+
+        /* without a codec the link goes back to raw messages */
+        compression_[idx].enabled = 0 != state.compressionEnabled && nullptr != codec_;
+        compression_[idx].peerAccepted = compression_[idx].enabled && 0 != state.compressionPeerAccepted;
+        compression_[idx].threshold = state.compressionThreshold;
+        transactions_[idx].active = false;
+    }
+
+    void CompleteTransaction(std::size_t idx, IsoTpTransactResult result, uint16_t responseSize) {
+        Transaction& transaction = transactions_[idx];
+
+        /* cleared first, the callback may start the next transaction */
+        transaction.active = false;
+        if (nullptr != transaction.cb) {
+            transaction.cb(peerAddrs_[idx], result, responseSize, transaction.arg);
+        }
+    }
+
+    /* Worst case bit time of a CAN frame with 11 bit ID, stuff bits and interframe space */
+    static constexpr uint32_t FrameBits(uint8_t size) {
+        return 47 + 8u * size + (34 + 8u * size - 1) / 4;
+    }
+
+    static int TxGate(const IsoTpLink* link, uint8_t size, void* arg) {
+        return static_cast<CanLinkManager*>(arg)->AdmitFrame(link, size);
+    }
+
+    int AdmitFrame(const IsoTpLink* link, uint8_t size) {
+        if (link != txGranted_) {
+            return ISOTP_RET_NOSPACE;
+        }
+        if (0 != busLoadBitsPerSec_) {
+            if (busLoadTokens_ < FrameBits(size)) {
+                txBlocked_ = true;
+                return ISOTP_RET_NOSPACE;
+            }
+            busLoadTokens_ -= FrameBits(size);
+        }
+        txAdmitted_ = true;
+        return ISOTP_RET_OK;
+    }
+
+    void RefillBusLoadTokens() {
+        uint32_t now = isotp_user_get_us();
+        uint64_t bits = static_cast<uint64_t>(static_cast<uint32_t>(now - busLoadLastUs_)) * busLoadBitsPerSec_ + busLoadRemainder_;
+
+        busLoadLastUs_ = now;
+        busLoadRemainder_ = static_cast<uint32_t>(bits % 1000000);
+        bits = bits / 1000000 + busLoadTokens_;
+        busLoadTokens_ = bits > busLoadBurstBits_ ? busLoadBurstBits_ : static_cast<uint32_t>(bits);
+    }
+
+    /* Lets the link send its next frame, returns false if it made no progress */
+    bool TrySendFrame(IsoTpLink& link) {
+        uint16_t offset = link.send_offset;
+        bool progress;
+
+        txGranted_ = &link;
+        txAdmitted_ = false;
+        isotp_on_tx_complete(&link);
+        txGranted_ = nullptr;
+
+        progress = link.send_offset != offset || ISOTP_SEND_STATUS_INPROGRESS != link.send_status;
+        if (!progress && txAdmitted_) {
+            /* admitted but refused by the driver: the TX FIFO is full */
+            txBlocked_ = true;
+        }
+        return progress;
+    }
+
+    void RunTxArbiter() {
+        if (!txArbiterEnabled_) {
+            return;
+        }
+        if (0 != busLoadBitsPerSec_) {
+            RefillBusLoadTokens();
+        }
+        txBlocked_ = false;
+
+        /* strict priority between classes: a class only gets the bus when the
+         * higher ones have no frame that may go out now
+         */
+        for (std::size_t begin = 0; begin < N;) {
+            std::size_t end = begin;
+            while (end < N && txPriority_[txOrder_[end]] == txPriority_[txOrder_[begin]]) {
+                ++end;
+            }
+            if (!RunDeficitRoundRobin(begin, end)) {
+                return;
+            }
+            begin = end;
+        }
+    }
+
+    /* Returns false when the bus (driver or bus load budget) is exhausted. The turn
+     * of the link that hit the limit resumes with the rest of its deficit.
+     */
+    bool RunDeficitRoundRobin(std::size_t begin, std::size_t end) {
+        std::size_t count = end - begin;
+        std::size_t& turn = txTurn_[begin];
+        bool& credited = txTurnCredited_[begin];
+
+        /* until every link of the class had a turn without sending */
+        for (std::size_t idle = 0; idle < count; turn = (turn + 1) % count) {
+            std::size_t idx = txOrder_[begin + turn];
+            IsoTpLink& link = isotpLinks_[idx];
+            bool sent = false;
+
+            if (ISOTP_SEND_STATUS_INPROGRESS == link.send_status) {
+                if (!credited) {
+                    txDeficit_[idx] += txQuantum_[idx];
+                    credited = true;
+                }
+                while (txDeficit_[idx] > 0 && ISOTP_SEND_STATUS_INPROGRESS == link.send_status) {
+                    if (!TrySendFrame(link)) {
+                        if (txBlocked_) {
+                            return false;
+                        }
+                        /* waiting for flow control or STmin, nothing queued right now */
+                        txDeficit_[idx] = 0;
+                        break;
+                    }
+                    --txDeficit_[idx];
+                    sent = true;
+                }
+            }
+            if (ISOTP_SEND_STATUS_INPROGRESS != link.send_status) {
+                txDeficit_[idx] = 0;
+            }
+            credited = false;
+            idle = sent ? 0 : idle + 1;
+        }
+        return true;
+    }
+
     /* bit 10: 1 for ISOTP CAN frame, 0 for non-ISOTP CAN frame;
      * bits 9-5: sender addr;
      * bits 4-0: receiver addr
      */
 
+    uint8_t LinkIndexFromReceiveCanId(uint32_t canId) const {
+        if ((canId >> (k_numCanAddrBits_ * 2)) != 1 || (canId & k_canAddrMask_) != (myCanAddr_ & k_canAddrMask_)) {
+            return k_noLink_;
+        }
+        return linkFromSenderAddr_[(canId >> k_numCanAddrBits_) & k_canAddrMask_];
+    }
+
     uint16_t MakeReceiveCanId(uint8_t peerCanAddr) {
         uint16_t canId = 1 << (k_numCanAddrBits_ * 2);
         /* I am the receiver */
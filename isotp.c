@@ -58,7 +58,49 @@ static int isotp_send_flow_control(const IsoTpLink* link, uint8_t flow_status, u
     return ret;
 }
 
-static int isotp_send_single_frame(const IsoTpLink* link) {
+/* send a single, first or consecutive frame, if the transmit gate lets it go out now */
+static int isotp_send_data_frame(const IsoTpLink* link, const uint8_t *data, uint8_t size) {
+    if (NULL != link->tx_gate_cb && ISOTP_RET_OK != link->tx_gate_cb(link, size, link->tx_gate_arg)) {
+        /* held back, retry later like a busy shim */
+        return ISOTP_RET_NOSPACE;
+    }
+
+    return isotp_user_send_can(link->send_arbitration_id, data, size
+    #if defined (ISO_TP_USER_SEND_CAN_ARG)
+    ,link->user_send_can_arg
+    #endif
+    );
+}
+
+/* get the next size bytes of payload at send_offset, pulling them from the data source when streaming */
+static int isotp_send_data(IsoTpLink *link, uint8_t *data, uint16_t size) {
+    int ret;
+
+    if (NULL == link->send_source_cb) {
+        (void) memcpy(data, link->send_buffer + link->send_offset, size);
+        return ISOTP_RET_OK;
+    }
+
+    /* bytes already pulled by a previous attempt stay staged in the send buffer */
+    while (link->send_stage_size < size) {
+        ret = link->send_source_cb(link, link->send_buffer + link->send_stage_size,
+                link->send_offset + link->send_stage_size, size - link->send_stage_size, link->send_source_arg);
+        if (ret < 0 || ret > size - link->send_stage_size) {
+            isotp_user_debug("Send aborted by data source.");
+            return ISOTP_RET_ERROR;
+        }
+        if (0 == ret) {
+            /* data not ready yet, retry on next call */
+            return ISOTP_RET_NOSPACE;
+        }
+        link->send_stage_size += (uint8_t) ret;
+    }
+    (void) memcpy(data, link->send_buffer, size);
+
+    return ISOTP_RET_OK;
+}
+
+static int isotp_send_single_frame(IsoTpLink* link) {
 
     IsoTpCanMessage message;
     int ret;
@@ -67,10 +109,18 @@ static int isotp_send_single_frame(const IsoTpLink* link) {
     /* multi frame message length must greater than 7  */
     assert(link->send_size <= 7);
 
+    /* pre-encoded by isotp_encode_frames */
+    if (NULL != link->send_frames) {
+        return isotp_send_data_frame(link, link->send_frames[0].data, link->send_frames[0].len);
+    }
+
     /* setup message  */
     message.as.single_frame.type = ISOTP_PCI_TYPE_SINGLE;
     message.as.single_frame.SF_DL = (uint8_t) link->send_size;
-    (void) memcpy(message.as.single_frame.data, link->send_buffer, link->send_size);
+    ret = isotp_send_data(link, message.as.single_frame.data, link->send_size);
+    if (ISOTP_RET_OK != ret) {
+        return ret;
+    }
 
     /* send message */
 #ifdef ISO_TP_FRAME_PADDING
@@ -80,11 +130,10 @@ static int isotp_send_single_frame(const IsoTpLink* link) {
     size = link->send_size + 1;
 #endif
 
-    ret = isotp_user_send_can(link->send_arbitration_id, message.as.data_array.ptr, size
-    #if defined (ISO_TP_USER_SEND_CAN_ARG)
-    ,link->user_send_can_arg
-    #endif
-    );
+    ret = isotp_send_data_frame(link, message.as.data_array.ptr, size);
+    if (ISOTP_RET_OK == ret) {
+        link->send_stage_size = 0;
+    }
 
     return ret;
 }
@@ -97,21 +146,25 @@ static int isotp_send_first_frame(IsoTpLink* link) {
     /* multi frame message length must greater than 7  */
     assert(link->send_size > 7);
 
-    /* setup message  */
-    message.as.first_frame.type = ISOTP_PCI_TYPE_FIRST_FRAME;
-    message.as.first_frame.FF_DL_low = (uint8_t) link->send_size;
-    message.as.first_frame.FF_DL_high = (uint8_t) (0x0F & (link->send_size >> 8));
-    (void) memcpy(message.as.first_frame.data, link->send_buffer, sizeof(message.as.first_frame.data));
-
-    /* send message */
-    ret = isotp_user_send_can(link->send_arbitration_id, message.as.data_array.ptr, sizeof(message) 
-    #if defined (ISO_TP_USER_SEND_CAN_ARG)
-    ,link->user_send_can_arg
-    #endif
+    if (NULL != link->send_frames) {
+        /* pre-encoded by isotp_encode_frames */
+        ret = isotp_send_data_frame(link, link->send_frames[0].data, link->send_frames[0].len);
+    } else {
+        /* setup message  */
+        message.as.first_frame.type = ISOTP_PCI_TYPE_FIRST_FRAME;
+        message.as.first_frame.FF_DL_low = (uint8_t) link->send_size;
+        message.as.first_frame.FF_DL_high = (uint8_t) (0x0F & (link->send_size >> 8));
+        ret = isotp_send_data(link, message.as.first_frame.data, sizeof(message.as.first_frame.data));
+        if (ISOTP_RET_OK != ret) {
+            return ret;
+        }
 
-    );
+        /* send message */
+        ret = isotp_send_data_frame(link, message.as.data_array.ptr, sizeof(message));
+    }
     if (ISOTP_RET_OK == ret) {
         link->send_offset += sizeof(message.as.first_frame.data);
+        link->send_stage_size = 0;
         link->send_sn = 1;
     }
 
@@ -128,32 +181,38 @@ static int isotp_send_consecutive_frame(IsoTpLink* link) {
     /* multi frame message length must greater than 7  */
     assert(link->send_size > 7);
 
-    /* setup message  */
-    message.as.consecutive_frame.type = TSOTP_PCI_TYPE_CONSECUTIVE_FRAME;
-    message.as.consecutive_frame.SN = link->send_sn;
     data_length = link->send_size - link->send_offset;
     if (data_length > sizeof(message.as.consecutive_frame.data)) {
         data_length = sizeof(message.as.consecutive_frame.data);
     }
-    (void) memcpy(message.as.consecutive_frame.data, link->send_buffer + link->send_offset, data_length);
 
-    /* send message */
+    if (NULL != link->send_frames) {
+        /* pre-encoded by isotp_encode_frames, the first frame carries 6 bytes and every consecutive frame 7 */
+        const IsoTpCanFrame *frame = &link->send_frames[1 + (link->send_offset - 6) / 7];
+        ret = isotp_send_data_frame(link, frame->data, frame->len);
+    } else {
+        /* setup message  */
+        message.as.consecutive_frame.type = TSOTP_PCI_TYPE_CONSECUTIVE_FRAME;
+        message.as.consecutive_frame.SN = link->send_sn;
+        ret = isotp_send_data(link, message.as.consecutive_frame.data, data_length);
+        if (ISOTP_RET_OK != ret) {
+            return ret;
+        }
+
+        /* send message */
 #ifdef ISO_TP_FRAME_PADDING
-    (void) memset(message.as.consecutive_frame.data + data_length, ISO_TP_FRAME_PADDING_VALUE, sizeof(message.as.consecutive_frame.data) - data_length);
-    size = sizeof(message);
+        (void) memset(message.as.consecutive_frame.data + data_length, ISO_TP_FRAME_PADDING_VALUE, sizeof(message.as.consecutive_frame.data) - data_length);
+        size = sizeof(message);
 #else
-    size = data_length + 1;
+        size = data_length + 1;
 #endif
 
-    ret = isotp_user_send_can(link->send_arbitration_id,
-            message.as.data_array.ptr, size
-#if defined (ISO_TP_USER_SEND_CAN_ARG)
-    ,link->user_send_can_arg
-#endif
-    );
+        ret = isotp_send_data_frame(link, message.as.data_array.ptr, size);
+    }
 
     if (ISOTP_RET_OK == ret) {
         link->send_offset += data_length;
+        link->send_stage_size = 0;
         if (++(link->send_sn) > 0x0F) {
             link->send_sn = 0;
         }
@@ -162,6 +221,162 @@ static int isotp_send_consecutive_frame(IsoTpLink* link) {
     return ret;
 }
 
+/* report a link event to the user */
+static void isotp_notify(IsoTpLink *link, IsoTpEventTypes event, int protocol_result) {
+    if (NULL != link->event_cb) {
+        link->event_cb(link, event, protocol_result, link->event_arg);
+    }
+}
+
+/* hand the staged data to the stream consumer */
+static int isotp_receive_flush(IsoTpLink *link) {
+    int ret;
+
+    if (0 == link->receive_stage_size) {
+        return ISOTP_RET_OK;
+    }
+
+    ret = link->receive_chunk_cb(link, link->receive_buffer, link->receive_offset - link->receive_stage_size,
+            link->receive_stage_size, link->receive_size, link->receive_chunk_arg);
+    if (ISOTP_RET_OK == ret) {
+        link->receive_stage_size = 0;
+    } else if (ISOTP_RET_NOSPACE != ret) {
+        isotp_user_debug("Receive aborted by stream callback.");
+        ret = ISOTP_RET_ERROR;
+    }
+
+    return ret;
+}
+
+/* hand received data to the streaming callback, or copy it into the receive buffer, and advance receive_offset */
+static int isotp_receive_data(IsoTpLink *link, const uint8_t *data, uint16_t size) {
+    int ret;
+
+    if (NULL != link->receive_chunk_cb) {
+        /* keep the message order, staged data goes first */
+        if (0 == link->receive_stage_size) {
+            ret = link->receive_chunk_cb(link, data, link->receive_offset, size, link->receive_size, link->receive_chunk_arg);
+            if (ISOTP_RET_OK == ret) {
+                link->receive_offset += size;
+                return ISOTP_RET_OK;
+            }
+            if (ISOTP_RET_NOSPACE != ret) {
+                isotp_user_debug("Receive aborted by stream callback.");
+                return ISOTP_RET_ERROR;
+            }
+        }
+
+        /* consumer not ready, stage the data in the receive buffer */
+        if (link->receive_stage_size + size > link->receive_buf_size) {
+            isotp_user_debug("Stream consumer too slow for receiving buffer.");
+            return ISOTP_RET_OVERFLOW;
+        }
+        (void) memcpy(link->receive_buffer + link->receive_stage_size, data, size);
+        link->receive_stage_size += size;
+        link->receive_offset += size;
+
+        return ISOTP_RET_ERROR == isotp_receive_flush(link) ? ISOTP_RET_ERROR : ISOTP_RET_OK;
+    }
+
+    (void) memcpy(link->receive_buffer + link->receive_offset, data, size);
+    link->receive_offset += size;
+    return ISOTP_RET_OK;
+}
+
+/* send FC.WAIT while not ready to receive, ISOTP_RET_OVERFLOW once ISO_TP_MAX_WFT_NUMBER were sent in a row */
+static int isotp_receive_wait(IsoTpLink *link) {
+    if (link->receive_wft_count >= ISO_TP_MAX_WFT_NUMBER) {
+        return ISOTP_RET_OVERFLOW;
+    }
+
+    link->receive_wft_count++;
+    isotp_send_flow_control(link, PCI_FLOW_STATUS_WAIT, 0, 0);
+    /* next FC.WAIT or CTS is due before the sender's N_Bs expires */
+    link->receive_timer_cr = isotp_user_get_us() + ISO_TP_WAIT_INTERVAL_US;
+
+    return ISOTP_RET_OK;
+}
+
+/* give up waiting for the receive buffer or the stream consumer */
+static void isotp_receive_wait_overrun(IsoTpLink *link) {
+    isotp_send_flow_control(link, PCI_FLOW_STATUS_OVERFLOW, 0, 0);
+    link->receive_fc_pending = 0;
+    link->receive_ff_held = 0;
+    link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_WFT_OVRN;
+    if (ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status) {
+        link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+    }
+    isotp_notify(link, ISOTP_EVENT_RECEIVE_ERROR, link->receive_protocol_result);
+}
+
+/* send CTS for the next block, a slow stream consumer only gets as many frames as can be staged */
+static int isotp_receive_continue(IsoTpLink *link) {
+    uint16_t block_size = ISO_TP_DEFAULT_BLOCK_SIZE;
+    uint16_t room;
+
+    if (NULL != link->receive_chunk_cb && link->receive_buf_size >= 7) {
+        if (ISOTP_RET_ERROR == isotp_receive_flush(link)) {
+            return ISOTP_RET_ERROR;
+        }
+
+        room = (link->receive_buf_size - link->receive_stage_size) / 7;
+        if (0 == room) {
+            /* hold back the CTS until the consumer took the staged data, let the sender wait meanwhile */
+            if (0 == link->receive_fc_pending) {
+                link->receive_fc_pending = 1;
+                link->receive_wft_count = 0;
+                if (ISO_TP_MAX_WFT_NUMBER > 0) {
+                    (void) isotp_receive_wait(link);
+                }
+            }
+            return ISOTP_RET_NOSPACE;
+        }
+        if (room * 7 < link->receive_size - link->receive_offset && (0 == block_size || room < block_size)) {
+            block_size = room > 0xFF ? 0xFF : room;
+        }
+    }
+
+    link->receive_fc_pending = 0;
+    link->receive_wft_count = 0;
+    link->receive_bs_count = (uint8_t) block_size;
+    isotp_send_flow_control(link, PCI_FLOW_STATUS_CONTINUE, link->receive_bs_count, ISO_TP_DEFAULT_ST_MIN_US);
+    /* refresh timer cs */
+    link->receive_timer_cr = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+
+    return ISOTP_RET_OK;
+}
+
+/* message fully received, a streamed message has already been handed over */
+static void isotp_receive_complete(IsoTpLink *link) {
+    link->receive_status = NULL == link->receive_chunk_cb ? ISOTP_RECEIVE_STATUS_FULL : ISOTP_RECEIVE_STATUS_IDLE;
+    isotp_notify(link, ISOTP_EVENT_RECEIVE_COMPLETE, link->receive_protocol_result);
+}
+
+/* abort the message being received */
+static void isotp_receive_abort(IsoTpLink *link, int protocol_result) {
+    link->receive_protocol_result = protocol_result;
+    link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+    isotp_notify(link, ISOTP_EVENT_RECEIVE_ERROR, link->receive_protocol_result);
+}
+
+/* retry handing staged data to a slow stream consumer, then finish the message or send the held back flow control */
+static void isotp_receive_resume_link(IsoTpLink *link) {
+    if (ISOTP_RECEIVE_STATUS_INPROGRESS != link->receive_status ||
+        (0 == link->receive_stage_size && 0 == link->receive_fc_pending)) {
+        return;
+    }
+
+    if (ISOTP_RET_ERROR == isotp_receive_flush(link)) {
+        isotp_receive_abort(link, ISOTP_PROTOCOL_RESULT_ERROR);
+    } else if (link->receive_offset >= link->receive_size) {
+        if (0 == link->receive_stage_size) {
+            isotp_receive_complete(link);
+        }
+    } else if (link->receive_fc_pending && ISOTP_RET_ERROR == isotp_receive_continue(link)) {
+        isotp_receive_abort(link, ISOTP_PROTOCOL_RESULT_ERROR);
+    }
+}
+
 static int isotp_receive_single_frame(IsoTpLink* link, const IsoTpCanMessage* message, uint8_t len) {
     /* check data length */
     if ((0 == message->as.single_frame.SF_DL) || (message->as.single_frame.SF_DL > (len - 1))) {
@@ -170,10 +385,12 @@ static int isotp_receive_single_frame(IsoTpLink* link, const IsoTpCanMessage* me
     }
 
     /* copying data */
-    (void) memcpy(link->receive_buffer, message->as.single_frame.data, message->as.single_frame.SF_DL);
     link->receive_size = message->as.single_frame.SF_DL;
-    
-    return ISOTP_RET_OK;
+    link->receive_offset = 0;
+    link->receive_stage_size = 0;
+    link->receive_fc_pending = 0;
+
+    return isotp_receive_data(link, message->as.single_frame.data, message->as.single_frame.SF_DL);
 }
 
 static int isotp_receive_first_frame(IsoTpLink *link, IsoTpCanMessage *message, uint8_t len) {
@@ -194,22 +411,25 @@ static int isotp_receive_first_frame(IsoTpLink *link, IsoTpCanMessage *message,
         return ISOTP_RET_LENGTH;
     }
     
-    if (payload_length > link->receive_buf_size) {
+    /* streaming receive is not limited by the buffer size */
+    if (NULL == link->receive_chunk_cb && payload_length > link->receive_buf_size) {
         isotp_user_debug("Multi-frame response too large for receiving buffer.");
         return ISOTP_RET_OVERFLOW;
     }
     
     /* copying data */
-    (void) memcpy(link->receive_buffer, message->as.first_frame.data, sizeof(message->as.first_frame.data));
     link->receive_size = payload_length;
-    link->receive_offset = sizeof(message->as.first_frame.data);
+    link->receive_offset = 0;
+    link->receive_stage_size = 0;
+    link->receive_fc_pending = 0;
     link->receive_sn = 1;
 
-    return ISOTP_RET_OK;
+    return isotp_receive_data(link, message->as.first_frame.data, sizeof(message->as.first_frame.data));
 }
 
 static int isotp_receive_consecutive_frame(IsoTpLink *link, IsoTpCanMessage *message, uint8_t len) {
     uint16_t remaining_bytes;
+    int ret;
     
     /* check sn */
     if (link->receive_sn != message->as.consecutive_frame.SN) {
@@ -227,9 +447,11 @@ static int isotp_receive_consecutive_frame(IsoTpLink *link, IsoTpCanMessage *mes
     }
 
     /* copying data */
-    (void) memcpy(link->receive_buffer + link->receive_offset, message->as.consecutive_frame.data, remaining_bytes);
+    ret = isotp_receive_data(link, message->as.consecutive_frame.data, remaining_bytes);
+    if (ISOTP_RET_OK != ret) {
+        return ret;
+    }
 
-    link->receive_offset += remaining_bytes;
     if (++(link->receive_sn) > 0x0F) {
         link->receive_sn = 0;
     }
@@ -251,12 +473,222 @@ static int isotp_receive_flow_control_frame(IsoTpLink *link, IsoTpCanMessage *me
     return ISOTP_RET_OK;
 }
 
+/* send the single frame or first frame of the message set up in link */
+static int isotp_send_first(IsoTpLink *link) {
+    int ret;
+
+    if (link->send_size < 8) {
+        /* send single frame */
+        ret = isotp_send_single_frame(link);
+        if (ISOTP_RET_OK == ret) {
+            link->send_status = ISOTP_SEND_STATUS_IDLE;
+            isotp_notify(link, ISOTP_EVENT_SEND_COMPLETE, ISOTP_PROTOCOL_RESULT_OK);
+        }
+    } else {
+        /* send multi-frame */
+        ret = isotp_send_first_frame(link);
+
+        /* init multi-frame control flags */
+        if (ISOTP_RET_OK == ret) {
+            link->send_bs_remain = 0;
+            link->send_st_min_us = 0;
+            link->send_wtf_count = 0;
+            link->send_timer_st = isotp_user_get_us();
+            link->send_timer_bs = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+            link->send_protocol_result = ISOTP_PROTOCOL_RESULT_OK;
+            link->send_status = ISOTP_SEND_STATUS_INPROGRESS;
+        }
+    }
+
+    return ret;
+}
+
+/* start sending the message set up in link */
+static int isotp_send_start(IsoTpLink *link) {
+    int ret;
+
+    ret = isotp_send_first(link);
+
+    /* keep the frame pending while the shim has no space, isotp_poll or isotp_on_tx_complete retries it */
+    if (ISOTP_RET_NOSPACE == ret) {
+        link->send_timer_bs = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+        link->send_protocol_result = ISOTP_PROTOCOL_RESULT_OK;
+        link->send_status = ISOTP_SEND_STATUS_INPROGRESS;
+        return 1;
+    }
+
+    return ret == ISOTP_RET_OK ? 1 : 0;
+}
+
+/* send the pending single/first frame, or the next consecutive frame if flow control and st_min permit */
+static int isotp_send_next(IsoTpLink *link) {
+    int ret;
+
+    /* nothing has been sent yet */
+    if (0 == link->send_offset) {
+        ret = isotp_send_first(link);
+    } else if (/* send data if bs_remain is invalid or bs_remain large than zero */
+    (ISOTP_INVALID_BS == link->send_bs_remain || link->send_bs_remain > 0) &&
+    /* and if st_min is zero or go beyond interval time */
+    (0 == link->send_st_min_us || IsoTpTimeAfter(isotp_user_get_us(), link->send_timer_st))) {
+
+        ret = isotp_send_consecutive_frame(link);
+        if (ISOTP_RET_OK == ret) {
+            if (ISOTP_INVALID_BS != link->send_bs_remain) {
+                link->send_bs_remain -= 1;
+            }
+            link->send_timer_bs = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+            link->send_timer_st = isotp_user_get_us() + link->send_st_min_us;
+
+            /* check if send finish */
+            if (link->send_offset >= link->send_size) {
+                link->send_status = ISOTP_SEND_STATUS_IDLE;
+                isotp_notify(link, ISOTP_EVENT_SEND_COMPLETE, link->send_protocol_result);
+            }
+        }
+    } else {
+        /* waiting for flow control or st_min */
+        return ISOTP_RET_INPROGRESS;
+    }
+
+    if (ISOTP_RET_OK != ret && ISOTP_RET_NOSPACE != ret) {
+        link->send_protocol_result = ISOTP_PROTOCOL_RESULT_ERROR;
+        link->send_status = ISOTP_SEND_STATUS_ERROR;
+        isotp_notify(link, ISOTP_EVENT_SEND_ERROR, link->send_protocol_result);
+    }
+
+    return ret;
+}
+
+/* handle a first frame received while idle, return 1 if need to start timer for isotp_poll */
+static int isotp_handle_first_frame(IsoTpLink *link, IsoTpCanMessage *message, uint8_t len) {
+    int ret;
+
+    /* update protocol result */
+    link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_OK;
+
+    /* handle message */
+    ret = isotp_receive_first_frame(link, message, len);
+
+    /* if overflow happened */
+    if (ISOTP_RET_OVERFLOW == ret) {
+        /* update protocol result */
+        link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_BUFFER_OVFLW;
+        /* change status */
+        link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+        /* send error message */
+        isotp_send_flow_control(link, PCI_FLOW_STATUS_OVERFLOW, 0, 0);
+        isotp_notify(link, ISOTP_EVENT_RECEIVE_ERROR, link->receive_protocol_result);
+        return 0;
+    }
+
+    /* if stream callback refused the message */
+    if (ISOTP_RET_ERROR == ret) {
+        link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_ERROR;
+        link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+        isotp_send_flow_control(link, PCI_FLOW_STATUS_OVERFLOW, 0, 0);
+        isotp_notify(link, ISOTP_EVENT_RECEIVE_ERROR, link->receive_protocol_result);
+        return 0;
+    }
+
+    /* if receive successful */
+    if (ISOTP_RET_OK == ret) {
+        /* change status */
+        link->receive_status = ISOTP_RECEIVE_STATUS_INPROGRESS;
+        /* refresh timer cs, held back flow control times out like a missing consecutive frame */
+        link->receive_timer_cr = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+        /* send fc frame */
+        if (ISOTP_RET_ERROR == isotp_receive_continue(link)) {
+            isotp_receive_abort(link, ISOTP_PROTOCOL_RESULT_ERROR);
+            return 0;
+        }
+
+        return 1;
+    }
+
+    return 0;
+}
+
+/* poll link, send_ret is set to the result of sending the next frame */
+static int isotp_poll_link(IsoTpLink *link, int *send_ret) {
+    int sendCompleted = 0, receiveCompleted = 1; /* If need to stop the periodic polling timer */
+
+    *send_ret = ISOTP_RET_INPROGRESS;
+
+    /* the poll sends whatever the driver has room for */
+    link->tx_complete_pending = 0;
+
+    /* frames queued by the interrupt */
+    if (NULL != link->rx_ring) {
+        (void) isotp_process_rx(link);
+    }
+
+    /* only polling when operation in progress */
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status) {
+
+        /* continue send data, if the shim reports that it isn't able to send a frame at present, retry on next call */
+        *send_ret = isotp_send_next(link);
+
+        /* a pre-encoded block goes out back to back */
+        while (NULL != link->send_frames && 0 == link->send_st_min_us && ISOTP_RET_OK == *send_ret &&
+               ISOTP_SEND_STATUS_INPROGRESS == link->send_status) {
+            *send_ret = isotp_send_next(link);
+        }
+
+        /* check timeout */
+        if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status && IsoTpTimeAfter(isotp_user_get_us(), link->send_timer_bs)) {
+            /* a frame still pending in the shim is an N_As timeout */
+            link->send_protocol_result = 0 == link->send_offset ? ISOTP_PROTOCOL_RESULT_TIMEOUT_A : ISOTP_PROTOCOL_RESULT_TIMEOUT_BS;
+            link->send_status = ISOTP_SEND_STATUS_ERROR;
+            isotp_notify(link, ISOTP_EVENT_SEND_ERROR, link->send_protocol_result);
+        }
+    } else {
+        /* ERROR or IDLE status, should stop polling timer in either case */
+
+        if (ISOTP_SEND_STATUS_ERROR == link->send_status) {
+            /* Reset send status to IDLE so can do next send */
+            link->send_status = ISOTP_SEND_STATUS_IDLE;
+        }
+        sendCompleted = 1;
+    }
+
+    /* hand staged data to a slow stream consumer */
+    isotp_receive_resume_link(link);
+
+    /* only polling when operation in progress */
+    if (ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status || link->receive_ff_held) {
+        
+        /* check timeout */
+        if (IsoTpTimeAfter(isotp_user_get_us(), link->receive_timer_cr)) {
+            if (link->receive_fc_pending || link->receive_ff_held) {
+                /* still not ready, keep the sender waiting */
+                if (ISOTP_RET_OK != isotp_receive_wait(link)) {
+                    isotp_receive_wait_overrun(link);
+                }
+            } else {
+                link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_TIMEOUT_CR;
+                link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+                isotp_notify(link, ISOTP_EVENT_RECEIVE_ERROR, link->receive_protocol_result);
+            }
+        }
+        if (ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status || link->receive_ff_held) {
+            receiveCompleted = 0;
+        }
+    }
+
+    return sendCompleted & receiveCompleted;
+}
+
+/* microseconds from now until IsoTpTimeAfter(now, deadline) becomes true, 0 if it already is */
+static uint32_t isotp_us_until(uint32_t now, uint32_t deadline) {
+    return IsoTpTimeAfter(now, deadline) ? 0 : deadline - now + 1;
+}
+
 ///////////////////////////////////////////////////////
 ///                 PUBLIC FUNCTIONS                ///
 ///////////////////////////////////////////////////////
 
 int isotp_send(IsoTpLink *link, const uint8_t payload[], uint16_t size) {
-    int ret;
 
     if (link == 0x0) {
         isotp_user_debug("Link is null!");
@@ -279,28 +711,130 @@ int isotp_send(IsoTpLink *link, const uint8_t payload[], uint16_t size) {
     /* copy into local buffer */
     link->send_size = size;
     link->send_offset = 0;
+    link->send_stage_size = 0;
+    link->send_source_cb = NULL;
+    link->send_frames = NULL;
     (void) memcpy(link->send_buffer, payload, size);
 
-    if (link->send_size < 8) {
-        /* send single frame */
-        ret = isotp_send_single_frame(link);
-    } else {
-        /* send multi-frame */
-        ret = isotp_send_first_frame(link);
+    return isotp_send_start(link);
+}
 
-        /* init multi-frame control flags */
-        if (ISOTP_RET_OK == ret) {
-            link->send_bs_remain = 0;
-            link->send_st_min_us = 0;
-            link->send_wtf_count = 0;
-            link->send_timer_st = isotp_user_get_us();
-            link->send_timer_bs = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
-            link->send_protocol_result = ISOTP_PROTOCOL_RESULT_OK;
-            link->send_status = ISOTP_SEND_STATUS_INPROGRESS;
+int isotp_send_stream(IsoTpLink *link, uint16_t size, IsoTpSendSourceCallback source, void *arg) {
+    if (link == 0x0 || source == 0x0) {
+        isotp_user_debug("Link or data source is null!");
+        return 0;
+    }
+
+    /* only one frame is staged, but 12 bits of FF_DL limit the message size */
+    if (size > 4095 || link->send_buf_size < (size < 7 ? size : 7)) {
+        isotp_user_debug("Message size too large or send buffer too small for streaming!");
+        return 0;
+    }
+
+    if (ISOTP_SEND_STATUS_IDLE != link->send_status) {
+        isotp_user_debug("Can only send when send status is in IDLE!");
+        return 0;
+    }
+
+    link->send_size = size;
+    link->send_offset = 0;
+    link->send_stage_size = 0;
+    link->send_source_cb = source;
+    link->send_source_arg = arg;
+    link->send_frames = NULL;
+
+    return isotp_send_start(link);
+}
+
+int isotp_encode_frames(const uint8_t payload[], uint16_t size, IsoTpCanFrame *frames, uint16_t max_frames) {
+    IsoTpCanMessage message;
+    uint16_t count, offset, data_length, idx;
+    uint8_t sn = 1;
+
+    count = ISOTP_ENCODED_FRAME_COUNT(size);
+    if (0 == size || size > 4095 || count > max_frames) {
+        return ISOTP_RET_OVERFLOW;
+    }
+
+    if (size <= 7) {
+        message.as.single_frame.type = ISOTP_PCI_TYPE_SINGLE;
+        message.as.single_frame.SF_DL = (uint8_t) size;
+        (void) memcpy(message.as.single_frame.data, payload, size);
+#ifdef ISO_TP_FRAME_PADDING
+        (void) memset(message.as.single_frame.data + size, ISO_TP_FRAME_PADDING_VALUE, sizeof(message.as.single_frame.data) - size);
+        frames[0].len = sizeof(message);
+#else
+        frames[0].len = (uint8_t) (size + 1);
+#endif
+        (void) memcpy(frames[0].data, message.as.data_array.ptr, sizeof(message));
+        return count;
+    }
+
+    message.as.first_frame.type = ISOTP_PCI_TYPE_FIRST_FRAME;
+    message.as.first_frame.FF_DL_low = (uint8_t) size;
+    message.as.first_frame.FF_DL_high = (uint8_t) (0x0F & (size >> 8));
+    (void) memcpy(message.as.first_frame.data, payload, sizeof(message.as.first_frame.data));
+    (void) memcpy(frames[0].data, message.as.data_array.ptr, sizeof(message));
+    frames[0].len = sizeof(message);
+    offset = sizeof(message.as.first_frame.data);
+
+    for (idx = 1; idx < count; ++idx) {
+        data_length = size - offset;
+        if (data_length > sizeof(message.as.consecutive_frame.data)) {
+            data_length = sizeof(message.as.consecutive_frame.data);
         }
+        message.as.consecutive_frame.type = TSOTP_PCI_TYPE_CONSECUTIVE_FRAME;
+        message.as.consecutive_frame.SN = sn;
+        (void) memcpy(message.as.consecutive_frame.data, payload + offset, data_length);
+#ifdef ISO_TP_FRAME_PADDING
+        (void) memset(message.as.consecutive_frame.data + data_length, ISO_TP_FRAME_PADDING_VALUE, sizeof(message.as.consecutive_frame.data) - data_length);
+        frames[idx].len = sizeof(message);
+#else
+        frames[idx].len = (uint8_t) (data_length + 1);
+#endif
+        (void) memcpy(frames[idx].data, message.as.data_array.ptr, sizeof(message));
+        offset += data_length;
+        sn = (sn + 1) & 0x0F;
     }
 
-    return ret == ISOTP_RET_OK ? 1 : 0;
+    return count;
+}
+
+int isotp_send_encoded(IsoTpLink *link, const IsoTpCanFrame *frames, uint16_t count) {
+    IsoTpCanMessage message;
+    uint16_t size;
+
+    if (link == 0x0 || frames == 0x0 || 0 == count) {
+        isotp_user_debug("Link or frames are null!");
+        return 0;
+    }
+
+    /* the message size is taken from the single or first frame */
+    (void) memcpy(message.as.data_array.ptr, frames[0].data, sizeof(message));
+    if (ISOTP_PCI_TYPE_SINGLE == message.as.common.type) {
+        size = message.as.single_frame.SF_DL;
+    } else if (ISOTP_PCI_TYPE_FIRST_FRAME == message.as.common.type) {
+        size = (uint16_t) ((message.as.first_frame.FF_DL_high << 8) + message.as.first_frame.FF_DL_low);
+    } else {
+        size = 0;
+    }
+    if (0 == size || ISOTP_ENCODED_FRAME_COUNT(size) != count) {
+        isotp_user_debug("Frames are not encoded by isotp_encode_frames!");
+        return 0;
+    }
+
+    if (ISOTP_SEND_STATUS_IDLE != link->send_status) {
+        isotp_user_debug("Can only send when send status is in IDLE!");
+        return 0;
+    }
+
+    link->send_size = size;
+    link->send_offset = 0;
+    link->send_stage_size = 0;
+    link->send_source_cb = NULL;
+    link->send_frames = frames;
+
+    return isotp_send_start(link);
 }
 
 int isotp_on_can_message(IsoTpLink *link, const uint8_t *data, uint8_t len) {
@@ -325,6 +859,7 @@ int isotp_on_can_message(IsoTpLink *link, const uint8_t *data, uint8_t len) {
              */
             if (ISOTP_RECEIVE_STATUS_IDLE != link->receive_status) {
                 link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_UNEXP_PDU;
+                isotp_notify(link, ISOTP_EVENT_RECEIVE_ERROR, link->receive_protocol_result);
                 break;
             }
 
@@ -335,8 +870,17 @@ int isotp_on_can_message(IsoTpLink *link, const uint8_t *data, uint8_t len) {
             ret = isotp_receive_single_frame(link, &message, len);
             
             if (ISOTP_RET_OK == ret) {
-                /* change status */
-                link->receive_status = ISOTP_RECEIVE_STATUS_FULL;
+                if (0 == link->receive_stage_size) {
+                    /* change status */
+                    isotp_receive_complete(link);
+                } else {
+                    /* staged for a slow stream consumer, isotp_poll hands it over */
+                    link->receive_status = ISOTP_RECEIVE_STATUS_INPROGRESS;
+                    link->receive_timer_cr = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+                    needStartPoll = 1;
+                }
+            } else if (ISOTP_RET_ERROR == ret || ISOTP_RET_OVERFLOW == ret) {
+                isotp_receive_abort(link, ISOTP_RET_ERROR == ret ? ISOTP_PROTOCOL_RESULT_ERROR : ISOTP_PROTOCOL_RESULT_BUFFER_OVFLW);
             }
             break;
         }
@@ -347,47 +891,34 @@ int isotp_on_can_message(IsoTpLink *link, const uint8_t *data, uint8_t len) {
              * call isotp_receive to retrieve the previous packet before overide the 
              * receieve buffer.
              */
-            if (ISOTP_RECEIVE_STATUS_IDLE != link->receive_status) {
-                link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_UNEXP_PDU;
+            if (ISOTP_RECEIVE_STATUS_FULL == link->receive_status && 0 == link->receive_ff_held &&
+                NULL == link->receive_chunk_cb && ISO_TP_MAX_WFT_NUMBER > 0) {
+                /* keep the first frame and let the sender wait instead of dropping the message,
+                 * it is handled when isotp_receive frees the receive buffer
+                 */
+                link->receive_ff_held = 1;
+                link->receive_ff_held_len = len;
+                link->receive_held_ff = message;
+                link->receive_wft_count = 0;
+                (void) isotp_receive_wait(link);
+                needStartPoll = 1;
                 break;
             }
 
-            /* update protocol result */
-            link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_OK;
-
-            /* handle message */
-            ret = isotp_receive_first_frame(link, &message, len);
-
-            /* if overflow happened */
-            if (ISOTP_RET_OVERFLOW == ret) {
-                /* update protocol result */
-                link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_BUFFER_OVFLW;
-                /* change status */
-                link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
-                /* send error message */
-                isotp_send_flow_control(link, PCI_FLOW_STATUS_OVERFLOW, 0, 0);
+            if (ISOTP_RECEIVE_STATUS_IDLE != link->receive_status) {
+                link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_UNEXP_PDU;
+                isotp_notify(link, ISOTP_EVENT_RECEIVE_ERROR, link->receive_protocol_result);
                 break;
             }
 
-            /* if receive successful */
-            if (ISOTP_RET_OK == ret) {
-                /* change status */
-                link->receive_status = ISOTP_RECEIVE_STATUS_INPROGRESS;
-                /* send fc frame */
-                link->receive_bs_count = ISO_TP_DEFAULT_BLOCK_SIZE;
-                isotp_send_flow_control(link, PCI_FLOW_STATUS_CONTINUE, link->receive_bs_count, ISO_TP_DEFAULT_ST_MIN_US);
-                /* refresh timer cs */
-                link->receive_timer_cr = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
-
-                needStartPoll = 1;
-            }
-            
+            needStartPoll = isotp_handle_first_frame(link, &message, len);
             break;
         }
         case TSOTP_PCI_TYPE_CONSECUTIVE_FRAME: {
             /* check if in receiving status */
             if (ISOTP_RECEIVE_STATUS_INPROGRESS != link->receive_status) {
                 link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_UNEXP_PDU;
+                isotp_notify(link, ISOTP_EVENT_RECEIVE_ERROR, link->receive_protocol_result);
                 break;
             }
 
@@ -398,6 +929,19 @@ int isotp_on_can_message(IsoTpLink *link, const uint8_t *data, uint8_t len) {
             if (ISOTP_RET_WRONG_SN == ret) {
                 link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_WRONG_SN;
                 link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+                isotp_notify(link, ISOTP_EVENT_RECEIVE_ERROR, link->receive_protocol_result);
+                break;
+            }
+
+            /* if stream callback aborted the message */
+            if (ISOTP_RET_ERROR == ret) {
+                isotp_receive_abort(link, ISOTP_PROTOCOL_RESULT_ERROR);
+                break;
+            }
+
+            /* if stream consumer fell behind by more than the receive buffer */
+            if (ISOTP_RET_OVERFLOW == ret) {
+                isotp_receive_abort(link, ISOTP_PROTOCOL_RESULT_BUFFER_OVFLW);
                 break;
             }
 
@@ -406,14 +950,15 @@ int isotp_on_can_message(IsoTpLink *link, const uint8_t *data, uint8_t len) {
                 /* refresh timer cs */
                 link->receive_timer_cr = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
                 
-                /* receive finished */
+                /* receive finished, unless staged data still waits for a slow stream consumer */
                 if (link->receive_offset >= link->receive_size) {
-                    link->receive_status = ISOTP_RECEIVE_STATUS_FULL;
+                    if (0 == link->receive_stage_size) {
+                        isotp_receive_complete(link);
+                    }
                 } else {
                     /* send fc when bs reaches limit */
-                    if (0 == --link->receive_bs_count) {
-                        link->receive_bs_count = ISO_TP_DEFAULT_BLOCK_SIZE;
-                        isotp_send_flow_control(link, PCI_FLOW_STATUS_CONTINUE, link->receive_bs_count, ISO_TP_DEFAULT_ST_MIN_US);
+                    if (0 == --link->receive_bs_count && ISOTP_RET_ERROR == isotp_receive_continue(link)) {
+                        isotp_receive_abort(link, ISOTP_PROTOCOL_RESULT_ERROR);
                     }
                 }
             }
@@ -421,8 +966,8 @@ int isotp_on_can_message(IsoTpLink *link, const uint8_t *data, uint8_t len) {
             break;
         }
         case ISOTP_PCI_TYPE_FLOW_CONTROL_FRAME:
-            /* handle fc frame only when sending in progress  */
-            if (ISOTP_SEND_STATUS_INPROGRESS != link->send_status) {
+            /* handle fc frame only when sending in progress and the first frame is out */
+            if (ISOTP_SEND_STATUS_INPROGRESS != link->send_status || 0 == link->send_offset) {
                 break;
             }
 
@@ -437,6 +982,7 @@ int isotp_on_can_message(IsoTpLink *link, const uint8_t *data, uint8_t len) {
                 if (PCI_FLOW_STATUS_OVERFLOW == message.as.flow_control.FS) {
                     link->send_protocol_result = ISOTP_PROTOCOL_RESULT_BUFFER_OVFLW;
                     link->send_status = ISOTP_SEND_STATUS_ERROR;
+                    isotp_notify(link, ISOTP_EVENT_SEND_ERROR, link->send_protocol_result);
                 }
 
                 /* wait */
@@ -446,6 +992,7 @@ int isotp_on_can_message(IsoTpLink *link, const uint8_t *data, uint8_t len) {
                     if (link->send_wtf_count > ISO_TP_MAX_WFT_NUMBER) {
                         link->send_protocol_result = ISOTP_PROTOCOL_RESULT_WFT_OVRN;
                         link->send_status = ISOTP_SEND_STATUS_ERROR;
+                        isotp_notify(link, ISOTP_EVENT_SEND_ERROR, link->send_protocol_result);
                     }
                 }
 
@@ -486,6 +1033,12 @@ int isotp_receive(IsoTpLink *link, uint8_t *payload, const uint16_t payload_size
 
     link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
 
+    /* the buffer is free now, accept the first frame the sender has been waiting with */
+    if (link->receive_ff_held) {
+        link->receive_ff_held = 0;
+        (void) isotp_handle_first_frame(link, &link->receive_held_ff, link->receive_ff_held_len);
+    }
+
     return ISOTP_RET_OK;
 }
 
@@ -509,64 +1062,168 @@ void isotp_config_rcvbuf(IsoTpLink* link, uint8_t *recvbuf, uint16_t recvbufsize
     link->receive_buf_size = recvbufsize;
 }
 
+void isotp_config_rcv_stream(IsoTpLink* link, IsoTpReceiveChunkCallback callback, void *arg) {
+    link->receive_chunk_cb = callback;
+    link->receive_chunk_arg = arg;
+}
+
+void isotp_config_event_cb(IsoTpLink* link, IsoTpEventCallback callback, void *arg) {
+    link->event_cb = callback;
+    link->event_arg = arg;
+}
+
+void isotp_config_tx_gate(IsoTpLink* link, IsoTpTxGateCallback callback, void *arg) {
+    link->tx_gate_cb = callback;
+    link->tx_gate_arg = arg;
+}
+
+void isotp_config_rx_ring(IsoTpLink* link, IsoTpCanFrame *frames, uint16_t count) {
+    uint16_t size = 1;
+
+    while (size <= count / 2) {
+        size <<= 1;
+    }
+    link->rx_ring = frames;
+    link->rx_ring_mask = NULL == frames || 0 == count ? 0 : size - 1;
+    link->rx_ring_head = 0;
+    link->rx_ring_tail = 0;
+    link->rx_ring_high_water = 0;
+    link->rx_ring_dropped = 0;
+    if (0 == count) {
+        link->rx_ring = NULL;
+    }
+}
+
+int isotp_on_can_message_isr(IsoTpLink *link, const uint8_t *data, uint8_t len) {
+    IsoTpCanFrame *slot;
+    uint16_t head, used;
+#if defined(ISO_TP_ISR_CYCLE_COUNTER)
+    uint32_t start = ISO_TP_ISR_CYCLE_COUNTER(), cycles;
+#endif
+
+    if (NULL == link->rx_ring) {
+        return ISOTP_RET_ERROR;
+    }
+    if (len < 2 || len > sizeof(slot->data)) {
+        return ISOTP_RET_LENGTH;
+    }
+
+    head = link->rx_ring_head;
+    used = (uint16_t) (head - link->rx_ring_tail);
+    if (used > link->rx_ring_mask) {
+        link->rx_ring_dropped++;
+        return ISOTP_RET_OVERFLOW;
+    }
+
+    slot = &link->rx_ring[head & link->rx_ring_mask];
+    slot->len = len;
+    (void) memcpy(slot->data, data, slot->len);
+
+    /* the frame must be visible before the task sees the new head */
+    ISOTP_MEMORY_BARRIER();
+    link->rx_ring_head = (uint16_t) (head + 1);
+
+    if (used + 1 > link->rx_ring_high_water) {
+        link->rx_ring_high_water = used + 1;
+    }
+
+#if defined(ISO_TP_ISR_CYCLE_COUNTER)
+    cycles = ISO_TP_ISR_CYCLE_COUNTER() - start;
+    if (cycles > link->rx_isr_max_cycles) {
+        link->rx_isr_max_cycles = cycles;
+    }
+#endif
+    return ISOTP_RET_OK;
+}
+
+int isotp_process_rx(IsoTpLink *link) {
+    int needStartPoll = 0;
+    uint16_t tail = link->rx_ring_tail;
+    IsoTpCanFrame *slot;
+
+    while (tail != link->rx_ring_head) {
+        /* read the frame only after the head that published it */
+        ISOTP_MEMORY_BARRIER();
+        slot = &link->rx_ring[tail & link->rx_ring_mask];
+        needStartPoll |= isotp_on_can_message(link, slot->data, slot->len);
+
+        /* the slot may be reused once the tail moved past it */
+        ISOTP_MEMORY_BARRIER();
+        link->rx_ring_tail = ++tail;
+    }
+
+    return needStartPoll;
+}
+
+int isotp_receive_resume(IsoTpLink *link) {
+    isotp_receive_resume_link(link);
+
+    return ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status ? 1 : 0;
+}
+
+int isotp_on_tx_complete(IsoTpLink *link) {
+    link->tx_complete_pending = 0;
+    if (ISOTP_SEND_STATUS_INPROGRESS != link->send_status) {
+        return 0;
+    }
+
+    (void) isotp_send_next(link);
+
+    return ISOTP_SEND_STATUS_INPROGRESS == link->send_status ? 1 : 0;
+}
+
+void isotp_on_tx_complete_isr(IsoTpLink *link) {
+    link->tx_complete_pending = 1;
+}
+
 int isotp_poll(IsoTpLink *link) {
-    int ret;
-    int sendCompleted = 0, receiveCompleted = 1; /* If need to stop the periodic polling timer */
+    int send_ret;
 
-    /* only polling when operation in progress */
-    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status) {
+    return isotp_poll_link(link, &send_ret);
+}
 
-        /* continue send data */
-        if (/* send data if bs_remain is invalid or bs_remain large than zero */
-        (ISOTP_INVALID_BS == link->send_bs_remain || link->send_bs_remain > 0) &&
-        /* and if st_min is zero or go beyond interval time */
-        (0 == link->send_st_min_us || IsoTpTimeAfter(isotp_user_get_us(), link->send_timer_st))) {
-            
-            ret = isotp_send_consecutive_frame(link);
-            if (ISOTP_RET_OK == ret) {
-                if (ISOTP_INVALID_BS != link->send_bs_remain) {
-                    link->send_bs_remain -= 1;
-                }
-                link->send_timer_bs = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
-                link->send_timer_st = isotp_user_get_us() + link->send_st_min_us;
+uint32_t isotp_poll_us(IsoTpLink *link) {
+    int send_ret;
+    uint32_t now, next = ISOTP_NO_DEADLINE, wait;
 
-                /* check if send finish */
-                if (link->send_offset >= link->send_size) {
-                    link->send_status = ISOTP_SEND_STATUS_IDLE;
-                }
-            } else if (ISOTP_RET_NOSPACE == ret) {
-                /* shim reported that it isn't able to send a frame at present, retry on next call */
-            } else {
-                link->send_status = ISOTP_SEND_STATUS_ERROR;
-            }
-        }
+    (void) isotp_poll_link(link, &send_ret);
+    now = isotp_user_get_us();
 
-        /* check timeout */
-        if (IsoTpTimeAfter(isotp_user_get_us(), link->send_timer_bs)) {
-            link->send_protocol_result = ISOTP_PROTOCOL_RESULT_TIMEOUT_BS;
-            link->send_status = ISOTP_SEND_STATUS_ERROR;
-        }
-    } else {
-        /* ERROR or IDLE status, should stop polling timer in either case */
+    /* the next poll resets the error status, frames queued and transmit confirmations raised meanwhile
+     * by the interrupts are due as well
+     */
+    if (ISOTP_SEND_STATUS_ERROR == link->send_status || link->rx_ring_tail != link->rx_ring_head ||
+        link->tx_complete_pending) {
+        return 0;
+    }
 
-        if (ISOTP_SEND_STATUS_ERROR == link->send_status) {
-            /* Reset send status to IDLE so can do next send */
-            link->send_status = ISOTP_SEND_STATUS_IDLE;
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status) {
+        /* N_As or N_Bs timeout */
+        next = isotp_us_until(now, link->send_timer_bs);
+
+        if (ISOTP_RET_NOSPACE == send_ret) {
+            wait = ISO_TP_NOSPACE_RETRY_US;
+        } else if (0 == link->send_offset) {
+            wait = 0;
+        } else if (ISOTP_INVALID_BS == link->send_bs_remain || link->send_bs_remain > 0) {
+            /* st_min expiry */
+            wait = 0 == link->send_st_min_us ? 0 : isotp_us_until(now, link->send_timer_st);
+        } else {
+            /* waiting for flow control */
+            wait = ISOTP_NO_DEADLINE;
+        }
+        if (wait < next) {
+            next = wait;
         }
-        sendCompleted = 1;
     }
 
-    /* only polling when operation in progress */
-    if (ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status) {
-        
-        /* check timeout */
-        if (IsoTpTimeAfter(isotp_user_get_us(), link->receive_timer_cr)) {
-            link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_TIMEOUT_CR;
-            link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
-        } else {
-            receiveCompleted = 0;
+    if (ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status || link->receive_ff_held) {
+        /* N_Cr timeout or next FC.WAIT */
+        wait = isotp_us_until(now, link->receive_timer_cr);
+        if (wait < next) {
+            next = wait;
         }
     }
 
-    return sendCompleted & receiveCompleted;
+    return next;
 }
@@ -14,6 +14,69 @@ extern "C" {
 #include "isotp_config.h"
 #include "isotp_user.h"
 
+struct IsoTpLink;
+
+/**
+ * @brief Streaming receive callback, see isotp_config_rcv_stream.
+ *
+ * @param link The @code IsoTpLink @endcode instance the data was received on.
+ * @param data The chunk of payload data, only valid during the call.
+ * @param offset Position of the chunk within the whole message.
+ * @param size The size of the chunk.
+ * @param total_size The size of the whole message as announced by the sender.
+ * @param arg The argument passed to isotp_config_rcv_stream.
+ *
+ * @return ISOTP_RET_OK to continue receiving, ISOTP_RET_NOSPACE if the consumer can't take the chunk
+ *  right now, any other value aborts the reception. A refused chunk is staged in the receive buffer and
+ *  handed over again, merged with the following data, by isotp_poll or isotp_receive_resume.
+ */
+typedef int (*IsoTpReceiveChunkCallback)(struct IsoTpLink *link, const uint8_t *data, uint16_t offset,
+                                         uint16_t size, uint16_t total_size, void *arg);
+
+/**
+ * @brief Streaming send data source, see isotp_send_stream.
+ *
+ * @param link The @code IsoTpLink @endcode instance sending the message.
+ * @param data Where to write the payload data to.
+ * @param offset Position of the requested data within the whole message.
+ * @param size The number of bytes requested, never more than 7.
+ * @param arg The argument passed to isotp_send_stream.
+ *
+ * @return The number of bytes written, less than requested (or 0) if the data is not ready yet and
+ *  should be requested again later, or ISOTP_RET_ERROR to abort the transmission.
+ */
+typedef int (*IsoTpSendSourceCallback)(struct IsoTpLink *link, uint8_t *data, uint16_t offset, uint16_t size, void *arg);
+
+/**
+ * @brief Link event callback, see isotp_config_event_cb.
+ *
+ * @param link The @code IsoTpLink @endcode instance the event occurred on.
+ * @param event What happened, one of @code IsoTpEventTypes @endcode.
+ * @param protocol_result The ISOTP_PROTOCOL_RESULT_* of the transfer.
+ * @param arg The argument passed to isotp_config_event_cb.
+ */
+typedef void (*IsoTpEventCallback)(struct IsoTpLink *link, IsoTpEventTypes event, int protocol_result, void *arg);
+
+/**
+ * @brief Transmit gate, see isotp_config_tx_gate.
+ *
+ * @param link The @code IsoTpLink @endcode instance about to send a frame.
+ * @param size The size of the CAN frame.
+ * @param arg The argument passed to isotp_config_tx_gate.
+ *
+ * @return ISOTP_RET_OK to let the frame go out now, ISOTP_RET_NOSPACE to hold it back and retry later.
+ */
+typedef int (*IsoTpTxGateCallback)(const struct IsoTpLink *link, uint8_t size, void *arg);
+
+/**
+ * @brief A raw CAN frame, queued by isotp_on_can_message_isr (see isotp_config_rx_ring) or encoded
+ * ready to send by isotp_encode_frames.
+ */
+typedef struct {
+    uint8_t len;
+    uint8_t data[8];
+} IsoTpCanFrame;
+
 /**
  * @brief Struct containing the data for linking an application to a CAN instance.
  * The data stored in this struct is used internally and may be used by software programs
@@ -38,6 +101,20 @@ typedef struct IsoTpLink {
                                                    end at receive FC */
     int                         send_protocol_result;
     uint8_t                     send_status;
+    /* streaming send, data is pulled from the source instead of send_buffer */
+    IsoTpSendSourceCallback     send_source_cb;
+    void*                       send_source_arg;
+    uint8_t                     send_stage_size; /* bytes pulled into send_buffer for the next frame */
+    /* pre-encoded send, frames are sent as they are instead of encoded from send_buffer */
+    const IsoTpCanFrame*         send_frames;
+    /* completion and error notification */
+    IsoTpEventCallback          event_cb;
+    void*                       event_arg;
+    /* transmit arbitration */
+    IsoTpTxGateCallback         tx_gate_cb;
+    void*                       tx_gate_arg;
+    /* transmit confirmation raised by the interrupt, taken by the task */
+    volatile uint8_t            tx_complete_pending;
     /* receiver paramters */
     uint32_t                    receive_arbitration_id;
     /* message buffer */
@@ -53,6 +130,26 @@ typedef struct IsoTpLink {
                                                      end at receive FC */
     int                         receive_protocol_result;
     uint8_t                     receive_status;                                                     
+    /* streaming receive, data is handed to the callback instead of receive_buffer */
+    IsoTpReceiveChunkCallback   receive_chunk_cb;
+    void*                       receive_chunk_arg;
+    uint16_t                    receive_stage_size; /* data refused by the stream consumer, staged in receive_buffer */
+    uint8_t                     receive_fc_pending; /* flow control held back until the consumer catches up */
+    /* receiver side FC.WAIT */
+    uint8_t                     receive_wft_count;  /* FC.WAIT frames sent in a row */
+    uint8_t                     receive_ff_held;    /* a first frame arrived before isotp_receive freed the buffer */
+    uint8_t                     receive_ff_held_len;
+    IsoTpCanMessage             receive_held_ff;
+    /* two stage receive, single producer (RX interrupt) single consumer (task) frame ring */
+    IsoTpCanFrame*               rx_ring;
+    uint16_t                    rx_ring_mask;       /* frame count - 1 */
+    volatile uint16_t           rx_ring_head;       /* frames queued, written by the interrupt only */
+    volatile uint16_t           rx_ring_tail;       /* frames processed, written by the task only */
+    uint16_t                    rx_ring_high_water; /* most frames queued at once */
+    uint32_t                    rx_ring_dropped;    /* frames lost because the ring was full */
+#if defined(ISO_TP_ISR_CYCLE_COUNTER)
+    uint32_t                    rx_isr_max_cycles;  /* worst case run time of isotp_on_can_message_isr */
+#endif
 
 #if defined(ISO_TP_USER_SEND_CAN_ARG)
     void*                       user_send_can_arg;
@@ -72,6 +169,61 @@ void isotp_init_link(IsoTpLink *link, uint16_t send_arbitration_id, uint16_t rec
 void isotp_config_sendbuf(IsoTpLink* link, uint8_t *sendbuf, uint16_t sendbufsize);
 void isotp_config_rcvbuf(IsoTpLink* link, uint8_t *recvbuf, uint16_t recvbufsize);
 
+/**
+ * @brief Switches the receiver of a link to streaming mode.
+ *
+ * Every single frame, first frame and consecutive frame payload is handed to the callback as soon
+ * as it arrives, in message order, so a message never needs to be held in RAM as a whole and is not
+ * limited by the receive buffer size. A message is complete when offset + size == total_size.
+ * In streaming mode isotp_receive never returns data.
+ *
+ * If the callback may return ISOTP_RET_NOSPACE, a receive buffer of at least 7 bytes must be
+ * configured. Refused data is staged there and the block size sent in flow control frames is limited
+ * to what fits into the free space, so a slow consumer throttles the sender instead of losing data.
+ * While nothing fits, the sender is kept waiting with up to ISO_TP_MAX_WFT_NUMBER FC.WAIT frames.
+ *
+ * @param link The @code IsoTpLink @endcode instance used.
+ * @param callback The chunk callback, NULL to go back to reassembling messages in the receive buffer.
+ * @param arg User argument passed to the callback.
+ */
+void isotp_config_rcv_stream(IsoTpLink* link, IsoTpReceiveChunkCallback callback, void *arg);
+
+/**
+ * @brief Registers a callback which is called at the moment a message has been received or sent
+ * completely, or a transfer failed, so the status does not have to be polled.
+ *
+ * The callback runs inside isotp_on_can_message, isotp_poll or isotp_send. It may call isotp_receive
+ * on ISOTP_EVENT_RECEIVE_COMPLETE and isotp_send on ISOTP_EVENT_SEND_COMPLETE.
+ *
+ * @param link The @code IsoTpLink @endcode instance used.
+ * @param callback The event callback, NULL to disable notifications.
+ * @param arg User argument passed to the callback.
+ */
+void isotp_config_event_cb(IsoTpLink* link, IsoTpEventCallback callback, void *arg);
+
+/**
+ * @brief Registers a gate which is asked before every single, first and consecutive frame is handed to
+ * isotp_user_send_can, so frames of several links can be scheduled by a common arbiter. A frame held
+ * back by the gate is treated like ISOTP_RET_NOSPACE from the shim and retried later. Flow control
+ * frames are not gated.
+ *
+ * @param link The @code IsoTpLink @endcode instance used.
+ * @param callback The gate, NULL to send frames as soon as they are due.
+ * @param arg User argument passed to the gate.
+ */
+void isotp_config_tx_gate(IsoTpLink* link, IsoTpTxGateCallback callback, void *arg);
+
+/**
+ * @brief Sets up the frame ring for two stage receive: isotp_on_can_message_isr only queues the frame
+ * and returns, isotp_process_rx (or isotp_poll) runs the protocol and sends the flow control frames in
+ * task context. The ring may be empty when calling this function.
+ *
+ * @param link The @code IsoTpLink @endcode instance used.
+ * @param frames Storage for the ring.
+ * @param count Number of frames in the storage, only the largest power of two up to count is used.
+ */
+void isotp_config_rx_ring(IsoTpLink* link, IsoTpCanFrame *frames, uint16_t count);
+
 /**
  * @brief Polling function; call this function periodically to handle timeouts, send consecutive frames, etc.
  *
@@ -80,6 +232,52 @@ void isotp_config_rcvbuf(IsoTpLink* link, uint8_t *recvbuf, uint16_t recvbufsize
  */
 int isotp_poll(IsoTpLink *link);
 
+/**
+ * @brief Polling function for tickless operation; does the same as isotp_poll, and returns when the
+ * link needs to be polled next, so a one-shot timer can be armed precisely instead of running a
+ * periodic timer as fast as the smallest STmin.
+ *
+ * @param link The @code IsoTpLink @endcode instance used.
+ *  - Return the microseconds until the next action of the link (STmin expiry, N_As, N_Bs or N_Cr
+ *    timeout), 0 if isotp_poll_us should be called again right away, or @code ISOTP_NO_DEADLINE @endcode
+ *    if no transfer is in progress and the timer can be stopped
+ */
+uint32_t isotp_poll_us(IsoTpLink *link);
+
+/**
+ * @brief Call when a stream consumer which refused data with ISOTP_RET_NOSPACE is ready again, to hand
+ * over the staged data and send the held back flow control right away instead of on the next isotp_poll.
+ *
+ * @param link The @code IsoTpLink @endcode instance used.
+ *  - Return 1 if the receive is still in progress and needs isotp_poll, else 0
+ */
+int isotp_receive_resume(IsoTpLink *link);
+
+/**
+ * @brief Transmit confirmation; call this function whenever the CAN driver has room for another frame
+ * to send the next frame of the link right away.
+ *
+ * A single or first frame that couldn't be sent because the driver returned ISOTP_RET_NOSPACE is retried,
+ * otherwise the next consecutive frame is sent if flow control and STmin permit it. Must not run
+ * concurrently with other calls on the same link, so call it from the task that polls the link, or
+ * from the TX interrupt only if no other call on the link can be interrupted by it. Otherwise use
+ * isotp_on_tx_complete_isr.
+ *
+ * @param link The @code IsoTpLink @endcode instance used.
+ *  - Return 1 if the send is still in progress and needs isotp_poll, else 0
+ */
+int isotp_on_tx_complete(IsoTpLink *link);
+
+/**
+ * @brief Interrupt side of the transmit confirmation, safe to call from the CAN driver's TX mailbox
+ * empty interrupt while the task is inside any other call on the same link. Only flags the link;
+ * the next isotp_poll or isotp_on_tx_complete in the task sends the next frame, and isotp_poll_us
+ * returns 0 while the flag is set.
+ *
+ * @param link The @code IsoTpLink @endcode instance used.
+ */
+void isotp_on_tx_complete_isr(IsoTpLink *link);
+
 /**
  * @brief Handles incoming CAN messages.
  * Determines whether an incoming message is a valid ISO-TP frame or not and handles it accordingly.
@@ -91,11 +289,36 @@ int isotp_poll(IsoTpLink *link);
  */
 int isotp_on_can_message(IsoTpLink *link, const uint8_t *data, uint8_t len);
 
+/**
+ * @brief Interrupt side of the two stage receive, see isotp_config_rx_ring. Copies the frame into the
+ * ring without touching the protocol state, so it may interrupt any other call on the same link. Must
+ * not run concurrently with itself on the same link.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param data The data received via CAN.
+ * @param len The length of the data received.
+ *  - Return ISOTP_RET_OK if the frame was queued, isotp_process_rx needs to run, ISOTP_RET_OVERFLOW
+ *    if the ring was full and the frame was dropped, ISOTP_RET_LENGTH if len is not 2 to 8 like
+ *    isotp_on_can_message takes, or ISOTP_RET_ERROR if no ring is configured
+ */
+int isotp_on_can_message_isr(IsoTpLink *link, const uint8_t *data, uint8_t len);
+
+/**
+ * @brief Task side of the two stage receive; handles the frames queued by isotp_on_can_message_isr in
+ * arrival order. Also done by isotp_poll.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ *  - Return 1 if need to start timer for isotp_poll, else 0
+ */
+int isotp_process_rx(IsoTpLink *link);
+
 /**
  * @brief Sends ISO-TP frames via CAN, using the ID set in the initialising function.
  *
  * Single-frame messages will be sent immediately when calling this function.
  * Multi-frame messages will be sent consecutively when calling isotp_poll.
+ * If isotp_user_send_can returns ISOTP_RET_NOSPACE, the single or first frame is kept pending and
+ * retried by isotp_poll or isotp_on_tx_complete.
  *
  * @param link The @code IsoTpLink @endcode instance used for transceiving data.
  * @param payload The payload to be sent. (Up to 4095 bytes).
@@ -109,6 +332,50 @@ int isotp_on_can_message(IsoTpLink *link, const uint8_t *data, uint8_t len);
  */
 int isotp_send(IsoTpLink *link, const uint8_t payload[], uint16_t size);
 
+/**
+ * @brief Sends a message whose payload is pulled from a data source while the frames are sent.
+ *
+ * The payload does not need to be resident before the first frame goes out, the source is asked for
+ * the bytes of each frame when the frame is due. Only the data of one frame is staged in the send
+ * buffer, so it needs to hold at least 7 bytes regardless of the message size.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param size The size of the payload to be sent. (Up to 4095 bytes).
+ * @param source The data source callback.
+ * @param arg User argument passed to the source.
+ *
+ * @return Return 1 if need to start timer for isotp_poll, else 0
+ */
+int isotp_send_stream(IsoTpLink *link, uint16_t size, IsoTpSendSourceCallback source, void *arg);
+
+/**
+ * @brief Encodes a whole message into ready to send CAN frames once, for payloads that are sent again
+ * and again or should go out without per frame encoding work. The first consecutive frame has SN 1.
+ *
+ * @param payload The payload to be encoded. (Up to 4095 bytes).
+ * @param size The size of the payload.
+ * @param frames Where to write the frames to.
+ * @param max_frames Number of frames that fit into frames, ISOTP_ENCODED_FRAME_COUNT(size) are needed.
+ *
+ * @return The number of frames written, or ISOTP_RET_OVERFLOW if the message is empty, too large or
+ *  doesn't fit into frames
+ */
+int isotp_encode_frames(const uint8_t payload[], uint16_t size, IsoTpCanFrame *frames, uint16_t max_frames);
+
+/**
+ * @brief Sends a message encoded by isotp_encode_frames. Flow control, STmin and timeouts are handled
+ * as for isotp_send, but the frames are handed to isotp_user_send_can as they are, and while STmin is 0
+ * isotp_poll sends all frames of a block back to back. The send buffer is not used. The frames must
+ * stay unchanged until the send completed, they may be sent on several links at the same time.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param frames The encoded frames.
+ * @param count The number of frames returned by isotp_encode_frames.
+ *
+ * @return Return 1 if need to start timer for isotp_poll, else 0
+ */
+int isotp_send_encoded(IsoTpLink *link, const IsoTpCanFrame *frames, uint16_t count);
+
 /**
  * @brief Receives and parses the received data and copies the parsed data in to the internal buffer.
  * @param link The @link IsoTpLink @endlink instance used to transceive data.
@@ -116,6 +383,9 @@ int isotp_send(IsoTpLink *link, const uint8_t payload[], uint16_t size);
  * @param payload_size The size of the received (raw) CAN data.
  * @param out_size A reference to a variable which will contain the size of the actual (parsed) data.
  *
+ * A first frame that arrived while the previous message was still unread has been answered with
+ * FC.WAIT, it is accepted by this call.
+ *
  * @return Possible return values:
  *      - @link ISOTP_RET_OK @endlink
  *      - @link ISOTP_RET_NO_DATA @endlink
@@ -0,0 +1,91 @@
+#ifndef ISOTP_CHECKPOINT_H
+#define ISOTP_CHECKPOINT_H
+
+#if !defined(__unix__) && !defined(__APPLE__)
+#error "isotp_checkpoint.hpp needs POSIX open and mmap"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Keeps the link states of a CanLinkManager across a restart of the process, e.g.
+ * for an upgrade, in a memory-mapped file:
+ *
+ * old process, on the way out, after the last Poll:
+ *     IsoTpCheckpoint::Save("/run/isotp.ckpt", manager);
+ *
+ * new process, after the links got their buffers and callbacks, before the first frame:
+ *     if (!IsoTpCheckpoint::Restore("/run/isotp.ckpt", manager)) {
+ *         // cold start, the peers time out and retry
+ *     }
+ *
+ * A transfer is only continued if no frame of it arrives while the process is down,
+ * e.g. a sender between consecutive frames or a receiver that sent flow control and
+ * has not been sent anything yet. A receiver in the middle of a block misses the
+ * consecutive frames sent meanwhile (WRONG_SN), a sender waiting for flow control
+ * misses it (N_Bs); those peers have to retry.
+ *
+ * The file is written under a temporary name and renamed, so a crash while saving
+ * never leaves a partial checkpoint. Restore removes the file, so a checkpoint
+ * is not taken up again after a later crash.
+ */
+class IsoTpCheckpoint {
+public:
+    template <typename Manager>
+    static bool Save(const char* path, const Manager& manager) {
+        std::string tmpPath = std::string(path) + ".tmp";
+        std::size_t size = manager.StateSize();
+        bool saved = false;
+
+        int fd = open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            return false;
+        }
+        if (0 == ftruncate(fd, static_cast<off_t>(size))) {
+            void* region = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (MAP_FAILED != region) {
+                std::size_t written = manager.SaveState(static_cast<uint8_t*>(region), size);
+                saved = 0 != written && 0 == msync(region, size, MS_SYNC);
+                munmap(region, size);
+                /* the upper bound was reserved, keep only what was written */
+                saved = saved && 0 == ftruncate(fd, static_cast<off_t>(written));
+            }
+        }
+        close(fd);
+        if (!saved || 0 != rename(tmpPath.c_str(), path)) {
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /* Return false if there is no checkpoint or it does not match the manager */
+    template <typename Manager>
+    static bool Restore(const char* path, Manager& manager) {
+        struct stat info;
+        bool restored = false;
+
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        if (0 == fstat(fd, &info) && info.st_size > 0) {
+            std::size_t size = static_cast<std::size_t>(info.st_size);
+            void* region = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (MAP_FAILED != region) {
+                restored = manager.RestoreState(static_cast<const uint8_t*>(region), size);
+                munmap(region, size);
+            }
+        }
+        close(fd);
+        unlink(path);
+        return restored;
+    }
+};
+
+#endif //ISOTP_CHECKPOINT_H
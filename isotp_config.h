@@ -15,13 +15,34 @@
 /* This parameter indicate how many FC N_PDU WTs can be transmitted by the 
  * receiver in a row.
  */
+#ifndef ISO_TP_MAX_WFT_NUMBER
 #define ISO_TP_MAX_WFT_NUMBER       1
+#endif
 
 /* Private: The default timeout to use when waiting for a response during a
  * multi-frame send or receive.
  */
 #define ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US 100000
 
+/* Time between two FC N_PDU WTs sent by the receiver while the receive buffer
+ * or the stream consumer is not ready, must be below the sender's N_Bs timeout.
+ */
+#ifndef ISO_TP_WAIT_INTERVAL_US
+#define ISO_TP_WAIT_INTERVAL_US (ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US / 2)
+#endif
+
+/* Time after which isotp_poll_us asks to be called again when the CAN driver had no
+ * space for a frame, if the driver doesn't call isotp_on_tx_complete.
+ */
+#ifndef ISO_TP_NOSPACE_RETRY_US
+#define ISO_TP_NOSPACE_RETRY_US 100
+#endif
+
+/* Optional: free running cycle counter read at entry and exit of isotp_on_can_message_isr, the worst
+ * case is kept in IsoTpLink.rx_isr_max_cycles, e.g. on a Cortex-M: (DWT->CYCCNT)
+ */
+//#define ISO_TP_ISR_CYCLE_COUNTER()
+
 /* Private: Determines if by default, padding is added to ISO-TP message frames.
  */
 //#define ISO_TP_FRAME_PADDING
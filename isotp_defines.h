@@ -47,6 +47,23 @@
 /* return logic true if 'a' is after 'b' */
 #define IsoTpTimeAfter(a,b) ((int32_t)((int32_t)(b) - (int32_t)(a)) < 0)
 
+/* orders the frame ring accesses between isotp_on_can_message_isr and isotp_process_rx */
+#ifndef ISOTP_MEMORY_BARRIER
+#if defined(__GNUC__)
+#define ISOTP_MEMORY_BARRIER() __sync_synchronize()
+#elif defined(_WIN32)
+#define ISOTP_MEMORY_BARRIER() MemoryBarrier()
+#else
+#define ISOTP_MEMORY_BARRIER()
+#endif
+#endif
+
+/* number of CAN frames of a message of the given size, see isotp_encode_frames */
+#define ISOTP_ENCODED_FRAME_COUNT(size) ((size) <= 7 ? 1 : 1 + (size) / 7)
+
+/* no timer needed, returned by isotp_poll_us */
+#define ISOTP_NO_DEADLINE      0xFFFFFFFFu
+
 /*  invalid bs */
 #define ISOTP_INVALID_BS       0xFFFF
 
@@ -64,6 +81,14 @@ typedef enum {
     ISOTP_RECEIVE_STATUS_FULL,
 } IsoTpReceiveStatusTypes;
 
+/* ISOTP link events, reported to the callback set with isotp_config_event_cb */
+typedef enum {
+    ISOTP_EVENT_RECEIVE_COMPLETE,
+    ISOTP_EVENT_SEND_COMPLETE,
+    ISOTP_EVENT_RECEIVE_ERROR,
+    ISOTP_EVENT_SEND_ERROR,
+} IsoTpEventTypes;
+
 /* can fram defination */
 #if defined(ISOTP_BYTE_ORDER_LITTLE_ENDIAN)
 typedef struct {
@@ -0,0 +1,125 @@
+#ifndef ISOTP_GATEWAY_H
+#define ISOTP_GATEWAY_H
+
+#include <array>
+#include <cstddef>
+#include "isotp.h"
+
+/* Forwards the ISO-TP messages received on one link to another link with
+ * cut-through: the first frame goes out as soon as the inbound first frame
+ * arrived, and each consecutive frame payload is passed on as soon as it
+ * arrived, so the latency per hop is about one frame instead of one message.
+ *
+ * The payload passes through a ring of RingSize bytes. When the outbound side
+ * falls behind the ring fills up, the inbound link stages the refused data in
+ * its receive buffer and holds back its flow control, which throttles the
+ * inbound sender to the outbound progress. The ring should be at least as large
+ * as the inbound receive buffer, the outbound send buffer needs 7 bytes.
+ *
+ * For both directions use two gateways with the links swapped, e.g.:
+ * IsoTpGateway<> toVehicle(&testerLink, &vehicleLink);
+ * IsoTpGateway<> toTester(&vehicleLink, &testerLink);
+ */
+template <std::size_t RingSize = 64>
+class IsoTpGateway {
+private:
+    static_assert(RingSize >= 7, "the ring must hold at least one consecutive frame");
+
+    IsoTpLink* inbound_;
+    IsoTpLink* outbound_;
+    std::array<uint8_t, RingSize> ring_;
+    std::size_t head_ = 0; /* bytes written to the ring */
+    std::size_t tail_ = 0; /* bytes read from the ring */
+
+public:
+    IsoTpGateway(IsoTpLink* inbound, IsoTpLink* outbound): inbound_(inbound), outbound_(outbound) {
+        isotp_config_rcv_stream(inbound_, &IsoTpGateway::OnChunk, this);
+    }
+
+    ~IsoTpGateway() {
+        isotp_config_rcv_stream(inbound_, nullptr, nullptr);
+    }
+
+    /* the links keep a pointer to the gateway */
+    IsoTpGateway(const IsoTpGateway&) = delete;
+    IsoTpGateway& operator=(const IsoTpGateway&) = delete;
+
+    /* Call for CAN frames received with the inbound link's receive ID */
+    int OnInboundCanMessage(const uint8_t* data, uint8_t len) {
+        return isotp_on_can_message(inbound_, data, len);
+    }
+
+    /* Call for CAN frames received with the outbound link's receive ID */
+    int OnOutboundCanMessage(const uint8_t* data, uint8_t len) {
+        int needStartPoll = isotp_on_can_message(outbound_, data, len);
+
+        /* a flow control frame may permit buffered data to go out, which makes room for the inbound side */
+        isotp_on_tx_complete(outbound_);
+        isotp_receive_resume(inbound_);
+        return needStartPoll;
+    }
+
+    /* Call periodically instead of isotp_poll on both links.
+     * Return 1 if need to stop timer for Poll, else 0
+     */
+    int Poll() {
+        int stopTimer = isotp_poll(outbound_);
+
+        stopTimer &= isotp_poll(inbound_);
+        return stopTimer;
+    }
+
+private:
+    std::size_t RingUsed() const {return head_ - tail_;}
+
+    static int OnChunk(IsoTpLink*, const uint8_t* data, uint16_t offset, uint16_t size, uint16_t totalSize, void* arg) {
+        return static_cast<IsoTpGateway*>(arg)->Forward(data, offset, size, totalSize);
+    }
+
+    static int Source(IsoTpLink*, uint8_t* data, uint16_t, uint16_t size, void* arg) {
+        return static_cast<IsoTpGateway*>(arg)->Pull(data, size);
+    }
+
+    int Forward(const uint8_t* data, uint16_t offset, uint16_t size, uint16_t totalSize) {
+        if (0 == offset) {
+            /* new message, wait until the outbound link finished the previous one */
+            if (ISOTP_SEND_STATUS_IDLE != outbound_->send_status) {
+                return ISOTP_RET_NOSPACE;
+            }
+            head_ = tail_ = 0;
+        } else if (ISOTP_SEND_STATUS_INPROGRESS != outbound_->send_status) {
+            /* the outbound transfer failed, drop the rest of the message */
+            return ISOTP_RET_ERROR;
+        }
+
+        if (RingSize - RingUsed() < size) {
+            return ISOTP_RET_NOSPACE;
+        }
+        for (uint16_t idx = 0; idx < size; ++idx) {
+            ring_[(head_ + idx) % RingSize] = data[idx];
+        }
+        head_ += size;
+
+        if (0 == offset) {
+            if (0 == isotp_send_stream(outbound_, totalSize, &IsoTpGateway::Source, this)) {
+                return ISOTP_RET_ERROR;
+            }
+        } else {
+            /* cut-through, forward right away if flow control and STmin permit */
+            isotp_on_tx_complete(outbound_);
+        }
+        return ISOTP_RET_OK;
+    }
+
+    int Pull(uint8_t* data, uint16_t size) {
+        uint16_t count = RingUsed() < size ? static_cast<uint16_t>(RingUsed()) : size;
+
+        for (uint16_t idx = 0; idx < count; ++idx) {
+            data[idx] = ring_[(tail_ + idx) % RingSize];
+        }
+        tail_ += count;
+        return count;
+    }
+};
+
+#endif //ISOTP_GATEWAY_H
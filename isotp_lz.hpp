@@ -0,0 +1,191 @@
+#ifndef ISOTP_LZ_H
+#define ISOTP_LZ_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/* Small LZ77 codec for ISO-TP payloads, writing the LZ4 block format, so any
+ * LZ4 block decoder can read the output. The compressor is greedy with one
+ * hash table of 2^HashBits positions (uint16_t, enough for ISO-TP messages),
+ * which is its whole working memory; the decompressor needs none.
+ *
+ * A block is a sequence of tokens: literal count (high nibble) and match length
+ * minus 4 (low nibble), each extended by bytes of 255 when the nibble is 15,
+ * followed by the literals and a 2 byte little endian match offset. The last
+ * token only carries literals.
+ */
+template <unsigned HashBits = 8>
+class IsoTpLz {
+private:
+    static constexpr uint16_t k_minMatch = 4;
+    /* LZ4 block rules: the last 5 bytes are literals, the last match starts 12 bytes before the end */
+    static constexpr uint16_t k_lastLiterals = 5;
+    static constexpr uint16_t k_matchStartLimit = 12;
+
+    std::array<uint16_t, 1u << HashBits> table_;
+
+public:
+    /* Return the compressed size, or 0 if it would not fit into capacity */
+    int Compress(const uint8_t* src, uint16_t size, uint8_t* dst, std::size_t capacity) {
+        std::size_t out = 0;
+        uint16_t anchor = 0;
+        uint16_t pos = 0;
+
+        table_.fill(0);
+        if (size > k_matchStartLimit) {
+            uint16_t matchStartEnd = size - k_matchStartLimit;
+            uint16_t matchEnd = size - k_lastLiterals;
+
+            while (pos < matchStartEnd) {
+                uint32_t sequence = Read32(src + pos);
+                uint16_t& slot = table_[Hash(sequence)];
+                uint16_t ref = slot;
+
+                slot = pos;
+                if (ref >= pos || Read32(src + ref) != sequence) {
+                    ++pos;
+                    continue;
+                }
+                uint16_t length = k_minMatch;
+                while (pos + length < matchEnd && src[ref + length] == src[pos + length]) {
+                    ++length;
+                }
+                /* extend backwards into the pending literals */
+                while (pos > anchor && ref > 0 && src[pos - 1] == src[ref - 1]) {
+                    --pos;
+                    --ref;
+                    ++length;
+                }
+                if (!EmitSequence(dst, capacity, out, src + anchor, pos - anchor, pos - ref, length)) {
+                    return 0;
+                }
+                pos += length;
+                anchor = pos;
+            }
+        }
+        if (!EmitSequence(dst, capacity, out, src + anchor, size - anchor, 0, 0)) {
+            return 0;
+        }
+        return static_cast<int>(out);
+    }
+
+    /* Decodes at most capacity bytes, a longer block is cut off there.
+     * Return the number of bytes written, or -1 if the block is malformed
+     */
+    static int Decompress(const uint8_t* src, std::size_t size, uint8_t* dst, std::size_t capacity) {
+        std::size_t in = 0;
+        std::size_t out = 0;
+
+        while (in < size && out < capacity) {
+            uint8_t token = src[in++];
+            std::size_t literals = token >> 4;
+
+            if (!ReadLength(src, size, in, literals)) {
+                return -1;
+            }
+            if (literals > size - in) {
+                return -1;
+            }
+            std::size_t copy = literals < capacity - out ? literals : capacity - out;
+            if (copy > 0) {
+                std::memcpy(dst + out, src + in, copy);
+            }
+            in += literals;
+            out += copy;
+            if (in == size || out == capacity) {
+                break;
+            }
+
+            if (size - in < 2) {
+                return -1;
+            }
+            std::size_t offset = src[in] | (src[in + 1] << 8);
+            std::size_t length = token & 0x0F;
+            in += 2;
+            if (0 == offset || offset > out || !ReadLength(src, size, in, length)) {
+                return -1;
+            }
+            length += k_minMatch;
+            /* byte by byte, the match may overlap the bytes it produces */
+            for (; length > 0 && out < capacity; --length, ++out) {
+                dst[out] = dst[out - offset];
+            }
+        }
+        return static_cast<int>(out);
+    }
+
+private:
+    static uint32_t Read32(const uint8_t* data) {
+        uint32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    static uint32_t Hash(uint32_t sequence) {
+        return (sequence * 2654435761u) >> (32 - HashBits);
+    }
+
+    static bool ReadLength(const uint8_t* src, std::size_t size, std::size_t& in, std::size_t& length) {
+        if (15 != length) {
+            return true;
+        }
+        uint8_t byte;
+        do {
+            if (in == size) {
+                return false;
+            }
+            byte = src[in++];
+            length += byte;
+        } while (255 == byte);
+        return true;
+    }
+
+    static bool WriteLength(uint8_t* dst, std::size_t capacity, std::size_t& out, std::size_t length) {
+        for (; length >= 255; length -= 255) {
+            if (out == capacity) {
+                return false;
+            }
+            dst[out++] = 255;
+        }
+        if (out == capacity) {
+            return false;
+        }
+        dst[out++] = static_cast<uint8_t>(length);
+        return true;
+    }
+
+    /* matchLength 0: last sequence, literals only */
+    static bool EmitSequence(uint8_t* dst, std::size_t capacity, std::size_t& out,
+                             const uint8_t* literals, std::size_t numLiterals, std::size_t offset, std::size_t matchLength) {
+        std::size_t matchCode = 0 == matchLength ? 0 : matchLength - k_minMatch;
+
+        if (out == capacity) {
+            return false;
+        }
+        dst[out++] = static_cast<uint8_t>(((numLiterals < 15 ? numLiterals : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+        if (numLiterals >= 15 && !WriteLength(dst, capacity, out, numLiterals - 15)) {
+            return false;
+        }
+        if (numLiterals > capacity - out) {
+            return false;
+        }
+        if (numLiterals > 0) {
+            std::memcpy(dst + out, literals, numLiterals);
+        }
+        out += numLiterals;
+        if (0 == matchLength) {
+            return true;
+        }
+
+        if (capacity - out < 2) {
+            return false;
+        }
+        dst[out++] = static_cast<uint8_t>(offset);
+        dst[out++] = static_cast<uint8_t>(offset >> 8);
+        return matchCode < 15 || WriteLength(dst, capacity, out, matchCode - 15);
+    }
+};
+
+#endif //ISOTP_LZ_H
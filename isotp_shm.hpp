@@ -0,0 +1,815 @@
+#ifndef ISOTP_SHM_H
+#define ISOTP_SHM_H
+
+#if !defined(__linux__)
+#error "isotp_shm.hpp needs memfd, eventfd and unix domain sockets"
+#endif
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <type_traits>
+#include <utility>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "isotp.h"
+
+/* Shared-memory ISO-TP transport between processes on one host: a daemon owns
+ * the CanLinkManager and the CAN interface, every client process gets a
+ * channel of two single-producer single-consumer message rings in a shared
+ * memory region, one towards the daemon and one towards the client.
+ *
+ * Messages are not copied between the rings and the links: a client writes its
+ * payload straight into the ring and the daemon sends it from there with
+ * isotp_send_stream, a received message is written straight into the client's
+ * ring with a streaming receive and read by the client in place. Eventfds wake
+ * the other side only when it sleeps, the unix domain socket is used to hand
+ * over the file descriptors and to notice a client going away.
+ */
+
+/* Control block of one ring, head and tail on their own cache lines */
+struct IsoTpShmRingCtl {
+    alignas(64) std::atomic<uint32_t> head;       /* bytes written, producer only */
+    alignas(64) std::atomic<uint32_t> tail;       /* bytes read, consumer only */
+    alignas(64) std::atomic<uint32_t> consumerSleeping;
+    std::atomic<uint32_t> producerSleeping;       /* producer waits for space */
+};
+
+/* Start of the shared memory region, followed by the data of both rings */
+struct IsoTpShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ringSize;
+    uint32_t grantedPeers;                        /* bit per peer addr whose messages the client receives */
+    std::atomic<uint32_t> sendsCompleted;         /* messages of the client sent successfully */
+    std::atomic<uint32_t> sendsFailed;            /* messages of the client that could not be sent */
+    IsoTpShmRingCtl toDaemon;
+    IsoTpShmRingCtl toClient;
+};
+
+/* Handle of a message ring in shared memory. A record is a 4 byte header (size,
+ * peer addr, kind) followed by the payload, padded to 4 bytes; a record never
+ * wraps around the end of the ring.
+ */
+class IsoTpShmRing {
+public:
+    static constexpr uint8_t k_kindMessage = 0;
+    static constexpr uint8_t k_kindWrap = 1;
+    static constexpr uint32_t k_headerSize = 4;
+
+    IsoTpShmRing() = default;
+    IsoTpShmRing(IsoTpShmRingCtl* ctl, uint8_t* data, uint32_t size): ctl_(ctl), data_(data), size_(size) {}
+
+    /* Producer: returns where to write size bytes of payload, nullptr if the ring is full */
+    uint8_t* Reserve(uint16_t size) {
+        uint32_t head = ctl_->head.load(std::memory_order_relaxed);
+        uint32_t tail = ctl_->tail.load(std::memory_order_acquire);
+        uint32_t pos = head & (size_ - 1);
+        uint32_t record = RecordSize(size);
+        uint32_t skip = size_ - pos < record ? size_ - pos : 0;
+
+        if (skip + record > size_ - (head - tail)) {
+            return nullptr;
+        }
+        reserveSkip_ = skip;
+        return data_ + (skip ? 0 : pos) + k_headerSize;
+    }
+
+    /* Producer: publishes the record reserved last, returns true if the consumer needs a wakeup */
+    bool Commit(uint8_t peer, uint16_t size) {
+        uint32_t head = ctl_->head.load(std::memory_order_relaxed);
+
+        if (0 != reserveSkip_) {
+            WriteHeader(head & (size_ - 1), 0, 0, k_kindWrap);
+            head += reserveSkip_;
+            reserveSkip_ = 0;
+        }
+        WriteHeader(head & (size_ - 1), size, peer, k_kindMessage);
+        /* sequentially consistent with the sleeping flag, so a wakeup can't get lost */
+        ctl_->head.store(head + RecordSize(size), std::memory_order_seq_cst);
+        return 0 != ctl_->consumerSleeping.exchange(0, std::memory_order_seq_cst);
+    }
+
+    /* Consumer: the oldest message, nullptr if the ring is empty or Corrupt() */
+    const uint8_t* Peek(uint8_t& peer, uint16_t& size) {
+        uint32_t tail = ctl_->tail.load(std::memory_order_relaxed);
+        uint32_t head;
+
+        while (!corrupt_ && tail != (head = ctl_->head.load(std::memory_order_acquire))) {
+            uint32_t pos = tail & (size_ - 1);
+            uint32_t used = head - tail;
+            uint8_t kind;
+
+            ReadHeader(pos, size, peer, kind);
+            /* the producer may be another process, a record must stay inside what it wrote */
+            uint32_t record = k_kindWrap == kind ? size_ - pos : RecordSize(size);
+            if (used > size_ || used < k_headerSize || record > used || record > size_ - pos) {
+                corrupt_ = true;
+                break;
+            }
+            if (k_kindWrap != kind) {
+                return data_ + pos + k_headerSize;
+            }
+            tail += record;
+            ctl_->tail.store(tail, std::memory_order_release);
+        }
+        return nullptr;
+    }
+
+    /* Consumer: true once Peek found a record outside the ring or beyond the head */
+    bool Corrupt() const {return corrupt_;}
+
+    /* Consumer: frees the message returned by Peek, returns true if the producer waits for space */
+    bool Release(uint16_t size) {
+        ctl_->tail.store(ctl_->tail.load(std::memory_order_relaxed) + RecordSize(size), std::memory_order_seq_cst);
+        return 0 != ctl_->producerSleeping.exchange(0, std::memory_order_seq_cst);
+    }
+
+    bool Empty() const {
+        return ctl_->tail.load(std::memory_order_seq_cst) == ctl_->head.load(std::memory_order_seq_cst);
+    }
+
+    IsoTpShmRingCtl* Ctl() {return ctl_;}
+
+private:
+    static constexpr uint32_t RecordSize(uint16_t size) {
+        return (k_headerSize + size + 3u) & ~3u;
+    }
+
+    void WriteHeader(uint32_t pos, uint16_t size, uint8_t peer, uint8_t kind) {
+        std::memcpy(data_ + pos, &size, sizeof(size));
+        data_[pos + 2] = peer;
+        data_[pos + 3] = kind;
+    }
+
+    void ReadHeader(uint32_t pos, uint16_t& size, uint8_t& peer, uint8_t& kind) const {
+        std::memcpy(&size, data_ + pos, sizeof(size));
+        peer = data_[pos + 2];
+        kind = data_[pos + 3];
+    }
+
+    IsoTpShmRingCtl* ctl_ = nullptr;
+    uint8_t* data_ = nullptr;
+    uint32_t size_ = 0;
+    uint32_t reserveSkip_ = 0;
+    bool corrupt_ = false;
+};
+
+/* The shared memory region and the eventfds of one client, as seen by either side */
+class IsoTpShmChannel {
+public:
+    static constexpr uint32_t k_magic = 0x49545053; /* "ITPS" */
+    static constexpr uint32_t k_version = 1;
+    /* two records of the largest message must fit */
+    static constexpr uint32_t k_minRingSize = 16384;
+
+    IsoTpShmChannel() = default;
+    ~IsoTpShmChannel() {Close();}
+    IsoTpShmChannel(const IsoTpShmChannel&) = delete;
+    IsoTpShmChannel& operator=(const IsoTpShmChannel&) = delete;
+
+    /* Daemon side: creates the region, ringSize must be a power of two */
+    bool Create(uint32_t ringSize) {
+        if (ringSize < k_minRingSize || 0 != (ringSize & (ringSize - 1))) {
+            return false;
+        }
+        memFd_ = memfd_create("isotp_shm", MFD_CLOEXEC);
+        toDaemonFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        toClientFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (memFd_ < 0 || toDaemonFd_ < 0 || toClientFd_ < 0 || 0 != ftruncate(memFd_, RegionSize(ringSize)) || !Map(ringSize)) {
+            Close();
+            return false;
+        }
+        header_->magic = k_magic;
+        header_->version = k_version;
+        header_->ringSize = ringSize;
+        return true;
+    }
+
+    /* Client side: maps the region received from the daemon, takes ownership of the fds */
+    bool Attach(int memFd, int toDaemonFd, int toClientFd) {
+        uint32_t probe[3]; /* magic, version, ringSize */
+
+        memFd_ = memFd;
+        toDaemonFd_ = toDaemonFd;
+        toClientFd_ = toClientFd;
+        if (static_cast<ssize_t>(sizeof(probe)) != pread(memFd_, probe, sizeof(probe), 0) || k_magic != probe[0] ||
+            k_version != probe[1] || probe[2] < k_minRingSize || !Map(probe[2])) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close() {
+        if (nullptr != header_) {
+            munmap(header_, RegionSize(header_->ringSize));
+            header_ = nullptr;
+        }
+        for (int* fd : {&memFd_, &toDaemonFd_, &toClientFd_}) {
+            if (*fd >= 0) {
+                close(*fd);
+                *fd = -1;
+            }
+        }
+    }
+
+    bool IsOpen() const {return nullptr != header_;}
+    IsoTpShmHeader* Header() {return header_;}
+    IsoTpShmRing& ToDaemon() {return toDaemon_;}
+    IsoTpShmRing& ToClient() {return toClient_;}
+    int ToDaemonEventFd() const {return toDaemonFd_;}
+    int ToClientEventFd() const {return toClientFd_;}
+
+    static void Wake(int eventFd) {
+        uint64_t one = 1;
+        (void) !write(eventFd, &one, sizeof(one));
+    }
+
+    static void ClearWake(int eventFd) {
+        uint64_t count;
+        (void) !read(eventFd, &count, sizeof(count));
+    }
+
+    /* Hands the three fds and one byte of data over a unix domain socket */
+    bool SendFds(int sock, uint8_t data) const {
+        int fds[3] = {memFd_, toDaemonFd_, toClientFd_};
+        char control[CMSG_SPACE(sizeof(fds))] = {};
+        struct iovec iov = {&data, sizeof(data)};
+        struct msghdr msg = {};
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+        return static_cast<ssize_t>(sizeof(data)) == sendmsg(sock, &msg, MSG_NOSIGNAL);
+    }
+
+    /* Receives the fds sent by SendFds and attaches to them */
+    bool ReceiveFds(int sock, uint8_t& data) {
+        int fds[3];
+        char control[CMSG_SPACE(sizeof(fds))] = {};
+        struct iovec iov = {&data, sizeof(data)};
+        struct msghdr msg = {};
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (static_cast<ssize_t>(sizeof(data)) != recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) {
+            return false;
+        }
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if (nullptr == cmsg || SCM_RIGHTS != cmsg->cmsg_type || CMSG_LEN(sizeof(fds)) != cmsg->cmsg_len) {
+            return false;
+        }
+        std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        return Attach(fds[0], fds[1], fds[2]);
+    }
+
+private:
+    static constexpr std::size_t DataOffset() {
+        return (sizeof(IsoTpShmHeader) + 63) & ~static_cast<std::size_t>(63);
+    }
+
+    static constexpr std::size_t RegionSize(uint32_t ringSize) {
+        return DataOffset() + 2 * static_cast<std::size_t>(ringSize);
+    }
+
+    bool Map(uint32_t ringSize) {
+        void* region = mmap(nullptr, RegionSize(ringSize), PROT_READ | PROT_WRITE, MAP_SHARED, memFd_, 0);
+        if (MAP_FAILED == region) {
+            return false;
+        }
+        uint8_t* data = static_cast<uint8_t*>(region) + DataOffset();
+        header_ = static_cast<IsoTpShmHeader*>(region);
+        toDaemon_ = IsoTpShmRing(&header_->toDaemon, data, ringSize);
+        toClient_ = IsoTpShmRing(&header_->toClient, data + ringSize, ringSize);
+        return true;
+    }
+
+    IsoTpShmHeader* header_ = nullptr;
+    IsoTpShmRing toDaemon_;
+    IsoTpShmRing toClient_;
+    int memFd_ = -1;
+    int toDaemonFd_ = -1;
+    int toClientFd_ = -1;
+};
+
+/* Client process side, e.g.:
+ * IsoTpShmClient client;
+ * client.Connect("/run/isotp.sock", 1u << 0x10);
+ * uint8_t* payload = client.BeginSend(size); fill payload; client.CommitSend(0x10, size);
+ * const uint8_t* msg = client.Receive(peer, size); use msg; client.Release(size);
+ */
+class IsoTpShmClient {
+public:
+    ~IsoTpShmClient() {Disconnect();}
+
+    /* peerMask: bit per peer addr whose messages this client wants to receive,
+     * peers already taken by another client are not granted
+     */
+    bool Connect(const char* path, uint32_t peerMask) {
+        struct sockaddr_un addr = {};
+        uint8_t status = 0;
+
+        sock_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+        if (sock_ < 0 || 0 != connect(sock_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) ||
+            static_cast<ssize_t>(sizeof(peerMask)) != send(sock_, &peerMask, sizeof(peerMask), MSG_NOSIGNAL) ||
+            !channel_.ReceiveFds(sock_, status) || 0 != status) {
+            Disconnect();
+            return false;
+        }
+        return true;
+    }
+
+    void Disconnect() {
+        channel_.Close();
+        if (sock_ >= 0) {
+            close(sock_);
+            sock_ = -1;
+        }
+    }
+
+    uint32_t GrantedPeers() {return channel_.Header()->grantedPeers;}
+    uint32_t SendsCompleted() {return channel_.Header()->sendsCompleted.load();}
+    uint32_t SendsFailed() {return channel_.Header()->sendsFailed.load();}
+    int EventFd() const {return channel_.ToClientEventFd();}
+
+    /* Returns where to write the payload of the next message, nullptr if the ring is full */
+    uint8_t* BeginSend(uint16_t size) {
+        IsoTpShmRing& ring = channel_.ToDaemon();
+        uint8_t* payload = ring.Reserve(size);
+
+        if (nullptr == payload) {
+            /* wake up by Wait when the daemon freed space, check again to not miss it */
+            ring.Ctl()->producerSleeping.store(1, std::memory_order_seq_cst);
+            payload = ring.Reserve(size);
+            if (nullptr != payload) {
+                ring.Ctl()->producerSleeping.store(0, std::memory_order_relaxed);
+            }
+        }
+        return payload;
+    }
+
+    /* Queues the message written after BeginSend, it is sent in order */
+    void CommitSend(uint8_t peerCanAddr, uint16_t size) {
+        if (channel_.ToDaemon().Commit(peerCanAddr, size)) {
+            IsoTpShmChannel::Wake(channel_.ToDaemonEventFd());
+        }
+    }
+
+    /* The next received message, valid until Release, nullptr if there is none */
+    const uint8_t* Receive(uint8_t& peerCanAddr, uint16_t& size) {
+        return channel_.ToClient().Peek(peerCanAddr, size);
+    }
+
+    void Release(uint16_t size) {
+        (void) channel_.ToClient().Release(size);
+    }
+
+    /* Blocks until a message arrived or space to send became free, or the timeout passed */
+    void Wait(int timeoutMs) {
+        IsoTpShmRing& ring = channel_.ToClient();
+        struct pollfd pfd = {channel_.ToClientEventFd(), POLLIN, 0};
+
+        ring.Ctl()->consumerSleeping.store(1, std::memory_order_seq_cst);
+        if (ring.Empty()) {
+            (void) poll(&pfd, 1, timeoutMs);
+        }
+        ring.Ctl()->consumerSleeping.store(0, std::memory_order_relaxed);
+        IsoTpShmChannel::ClearWake(channel_.ToClientEventFd());
+    }
+
+private:
+    IsoTpShmChannel channel_;
+    int sock_ = -1;
+};
+
+/* Daemon process side, owns the links of a CanLinkManager and serves up to
+ * MaxClients clients. It registers the manager's event callback and streaming
+ * receive on all links, the links need a receive buffer of at least 7 bytes and
+ * a send buffer of at least 7 bytes.
+ *
+ * Each client's messages are sent one after the other in queue order. A received
+ * message goes to the client that was granted its peer; while one message is
+ * being written to a client's ring, messages of other peers for the same client
+ * are held back with flow control.
+ */
+template <typename Manager, std::size_t MaxClients = 8>
+class IsoTpShmDaemon {
+private:
+    static constexpr uint8_t k_noClient_ = 0xFF;
+    static constexpr uint8_t k_noLink_ = 0xFF;
+    static constexpr uint8_t k_addrMask_ = 0x1F;
+    static constexpr std::size_t k_numLinks_ = std::tuple_size<typename std::remove_reference<decltype(std::declval<Manager&>().GetIsotpLinks())>::type>::value;
+
+    struct Client {
+        IsoTpShmChannel channel;
+        int sock = -1;
+        bool closing = false;
+        bool sending = false;          /* the head record of its ring is being sent */
+        uint8_t receivingLink = k_noLink_; /* link writing into its ring */
+    };
+
+    Manager& manager_;
+    int listenSock_ = -1;
+    std::array<Client, MaxClients> clients_;
+    std::array<int, MaxClients> pendingSocks_;   /* accepted, peer mask not yet read */
+    std::array<uint8_t, k_numLinks_> rxOwner_;
+    std::array<uint8_t, k_numLinks_> txClient_;
+    std::array<const uint8_t*, k_numLinks_> txData_{};
+    std::array<uint8_t*, k_numLinks_> rxData_{};
+    uint32_t ringSize_;
+    bool inSendNext_ = false;
+
+public:
+    explicit IsoTpShmDaemon(Manager& manager, uint32_t ringSize = 65536): manager_(manager), ringSize_(ringSize) {
+        rxOwner_.fill(k_noClient_);
+        txClient_.fill(k_noClient_);
+        pendingSocks_.fill(-1);
+        manager_.SetEventCallback(&IsoTpShmDaemon::OnEvent, this);
+        for (auto& link : manager_.GetIsotpLinks()) {
+            isotp_config_rcv_stream(&link, &IsoTpShmDaemon::OnChunk, this);
+        }
+    }
+
+    ~IsoTpShmDaemon() {
+        for (auto& link : manager_.GetIsotpLinks()) {
+            isotp_config_rcv_stream(&link, nullptr, nullptr);
+        }
+        manager_.SetEventCallback(nullptr, nullptr);
+        for (std::size_t idx = 0; idx < MaxClients; ++idx) {
+            CloseClient(idx);
+        }
+        for (int sock : pendingSocks_) {
+            if (sock >= 0) {
+                close(sock);
+            }
+        }
+        if (listenSock_ >= 0) {
+            close(listenSock_);
+        }
+    }
+
+    IsoTpShmDaemon(const IsoTpShmDaemon&) = delete;
+    IsoTpShmDaemon& operator=(const IsoTpShmDaemon&) = delete;
+
+    bool Listen(const char* path) {
+        struct sockaddr_un addr = {};
+
+        listenSock_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+        unlink(path);
+        return listenSock_ >= 0 && 0 == bind(listenSock_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) &&
+               0 == listen(listenSock_, static_cast<int>(MaxClients));
+    }
+
+    /* Fills the fds to wait for with poll() next to the CAN socket, call right before poll().
+     * Return the number of fds written
+     */
+    std::size_t GetPollFds(struct pollfd* fds, std::size_t max) {
+        std::size_t count = 0;
+
+        if (count < max) {
+            fds[count++] = {listenSock_, POLLIN, 0};
+        }
+        for (int sock : pendingSocks_) {
+            if (sock >= 0 && count < max) {
+                fds[count++] = {sock, POLLIN, 0};
+            }
+        }
+        for (std::size_t idx = 0; idx < MaxClients; ++idx) {
+            Client& client = clients_[idx];
+            if (!client.channel.IsOpen() || count + 2 > max) {
+                continue;
+            }
+            fds[count++] = {client.sock, POLLIN, 0};
+            fds[count++] = {client.channel.ToDaemonEventFd(), POLLIN, 0};
+            client.channel.ToDaemon().Ctl()->consumerSleeping.store(1, std::memory_order_seq_cst);
+            if (CanSendNext(idx)) {
+                /* don't sleep on a message that was queued before the flag was set; the messages
+                 * already handed to a link or waiting for a busy link are picked up by the send events
+                 */
+                IsoTpShmChannel::Wake(client.channel.ToDaemonEventFd());
+            }
+        }
+        return count;
+    }
+
+    /* Handles new and closed clients reported by poll() and starts sending queued messages.
+     * fds may contain other fds, which are ignored.
+     */
+    void Process(const struct pollfd* fds, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            if (0 == fds[i].revents) {
+                continue;
+            }
+            if (fds[i].fd == listenSock_) {
+                Accept();
+                continue;
+            }
+            if (ReadPeerMask(fds[i].fd)) {
+                continue;
+            }
+            for (std::size_t idx = 0; idx < MaxClients; ++idx) {
+                Client& client = clients_[idx];
+                if (!client.channel.IsOpen()) {
+                    continue;
+                }
+                if (fds[i].fd == client.sock) {
+                    char byte;
+                    ssize_t ret = recv(client.sock, &byte, sizeof(byte), MSG_DONTWAIT);
+                    if (0 == ret || (ret < 0 && EAGAIN != errno && EWOULDBLOCK != errno)) {
+                        Disconnect(idx);
+                    }
+                } else if (fds[i].fd == client.channel.ToDaemonEventFd()) {
+                    IsoTpShmChannel::ClearWake(fds[i].fd);
+                }
+            }
+        }
+
+        for (std::size_t idx = 0; idx < MaxClients; ++idx) {
+            if (clients_[idx].channel.IsOpen()) {
+                clients_[idx].channel.ToDaemon().Ctl()->consumerSleeping.store(0, std::memory_order_relaxed);
+                SendNext(idx);
+            }
+        }
+    }
+
+private:
+    /* The client sends its peer mask right after connecting, it is read by
+     * ReadPeerMask once poll() reports it, so a slow client can't stall the daemon
+     */
+    void Accept() {
+        int sock;
+
+        while ((sock = accept4(listenSock_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            std::size_t slot = 0;
+
+            while (slot < MaxClients && pendingSocks_[slot] >= 0) {
+                ++slot;
+            }
+            if (slot == MaxClients) {
+                close(sock);
+                continue;
+            }
+            pendingSocks_[slot] = sock;
+        }
+    }
+
+    /* Return false if sock is not a pending connection */
+    bool ReadPeerMask(int sock) {
+        std::size_t slot = 0;
+        std::size_t idx = 0;
+        uint32_t peerMask = 0;
+
+        while (slot < MaxClients && pendingSocks_[slot] != sock) {
+            ++slot;
+        }
+        if (slot == MaxClients) {
+            return false;
+        }
+        ssize_t ret = recv(sock, &peerMask, sizeof(peerMask), 0);
+        if (ret < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+            return true;
+        }
+        pendingSocks_[slot] = -1;
+        while (idx < MaxClients && clients_[idx].channel.IsOpen()) {
+            ++idx;
+        }
+        if (static_cast<ssize_t>(sizeof(peerMask)) != ret || idx == MaxClients || !clients_[idx].channel.Create(ringSize_)) {
+            close(sock);
+            return true;
+        }
+
+        Client& client = clients_[idx];
+        uint32_t granted = 0;
+        for (std::size_t linkIdx = 0; linkIdx < k_numLinks_; ++linkIdx) {
+            uint8_t peer = PeerOf(linkIdx);
+            if ((peerMask & (1u << peer)) && k_noClient_ == rxOwner_[linkIdx]) {
+                rxOwner_[linkIdx] = static_cast<uint8_t>(idx);
+                granted |= 1u << peer;
+            }
+        }
+        client.channel.Header()->grantedPeers = granted;
+        client.sock = sock;
+        client.closing = false;
+        client.sending = false;
+        client.receivingLink = k_noLink_;
+        if (!client.channel.SendFds(sock, 0)) {
+            Disconnect(idx);
+        }
+        return true;
+    }
+
+    void Disconnect(std::size_t idx) {
+        for (std::size_t linkIdx = 0; linkIdx < k_numLinks_; ++linkIdx) {
+            if (rxOwner_[linkIdx] != idx) {
+                continue;
+            }
+            rxOwner_[linkIdx] = k_noClient_;
+            /* the rest of a message being written into the ring must not reach the
+             * next owner of the link, whose ring is somewhere else
+             */
+            if (nullptr != rxData_[linkIdx]) {
+                IsoTpLink& link = manager_.GetIsotpLinks()[linkIdx];
+                link.receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+                link.receive_stage_size = 0;
+                link.receive_fc_pending = 0;
+                rxData_[linkIdx] = nullptr;
+            }
+        }
+        clients_[idx].receivingLink = k_noLink_;
+        clients_[idx].closing = true;
+        /* a link may still send from the client's ring */
+        if (!clients_[idx].sending) {
+            CloseClient(idx);
+        }
+    }
+
+    void CloseClient(std::size_t idx) {
+        Client& client = clients_[idx];
+
+        client.channel.Close();
+        if (client.sock >= 0) {
+            close(client.sock);
+            client.sock = -1;
+        }
+        client.closing = false;
+        client.sending = false;
+    }
+
+    uint8_t PeerOf(std::size_t linkIdx) {
+        return static_cast<uint8_t>(manager_.GetIsotpLinks()[linkIdx].send_arbitration_id & k_addrMask_);
+    }
+
+    std::size_t LinkIndex(const IsoTpLink* link) {
+        return static_cast<std::size_t>(link - manager_.GetIsotpLinks().data());
+    }
+
+    /* True if SendNext has something to do: the client's oldest message waits for a free
+     * link, or its ring is corrupt
+     */
+    bool CanSendNext(std::size_t idx) {
+        Client& client = clients_[idx];
+        uint8_t peer;
+        uint16_t size;
+
+        if (client.sending || client.closing) {
+            return false;
+        }
+        if (nullptr == client.channel.ToDaemon().Peek(peer, size)) {
+            return client.channel.ToDaemon().Corrupt();
+        }
+        IsoTpLink* link = manager_.GetLinkFromPeerAddr(peer);
+        return nullptr == link || ISOTP_SEND_STATUS_IDLE == link->send_status;
+    }
+
+    /* Starts sending the client's oldest message if its link is free */
+    void SendNext(std::size_t idx) {
+        Client& client = clients_[idx];
+        uint8_t peer;
+        uint16_t size;
+        const uint8_t* payload;
+
+        /* a single frame completes inside isotp_send_stream, don't recurse through HandleEvent */
+        inSendNext_ = true;
+        while (!client.sending && !client.closing && nullptr != (payload = client.channel.ToDaemon().Peek(peer, size))) {
+            IsoTpLink* link = manager_.GetLinkFromPeerAddr(peer);
+
+            if (nullptr != link && ISOTP_SEND_STATUS_IDLE != link->send_status) {
+                /* the link is busy with another client's message */
+                break;
+            }
+            if (nullptr == link || 0 == size) {
+                client.channel.Header()->sendsFailed.fetch_add(1);
+                ReleaseSent(idx, size);
+                continue;
+            }
+
+            std::size_t linkIdx = LinkIndex(link);
+            client.sending = true;
+            txClient_[linkIdx] = static_cast<uint8_t>(idx);
+            txData_[linkIdx] = payload;
+            if (0 == isotp_send_stream(link, size, &IsoTpShmDaemon::Source, this)) {
+                txClient_[linkIdx] = k_noClient_;
+                client.sending = false;
+                client.channel.Header()->sendsFailed.fetch_add(1);
+                ReleaseSent(idx, size);
+            }
+        }
+        inSendNext_ = false;
+        if (client.channel.ToDaemon().Corrupt()) {
+            Disconnect(idx);
+        }
+    }
+
+    void ReleaseSent(std::size_t idx, uint16_t size) {
+        if (clients_[idx].channel.ToDaemon().Release(size)) {
+            IsoTpShmChannel::Wake(clients_[idx].channel.ToClientEventFd());
+        }
+    }
+
+    static int Source(IsoTpLink* link, uint8_t* data, uint16_t offset, uint16_t size, void* arg) {
+        IsoTpShmDaemon* self = static_cast<IsoTpShmDaemon*>(arg);
+
+        std::memcpy(data, self->txData_[self->LinkIndex(link)] + offset, size);
+        return size;
+    }
+
+    static int OnChunk(IsoTpLink* link, const uint8_t* data, uint16_t offset, uint16_t size, uint16_t totalSize, void* arg) {
+        return static_cast<IsoTpShmDaemon*>(arg)->WriteChunk(link, data, offset, size, totalSize);
+    }
+
+    int WriteChunk(IsoTpLink* link, const uint8_t* data, uint16_t offset, uint16_t size, uint16_t totalSize) {
+        std::size_t linkIdx = LinkIndex(link);
+        uint8_t owner = rxOwner_[linkIdx];
+
+        if (k_noClient_ == owner) {
+            return ISOTP_RET_ERROR;
+        }
+        Client& client = clients_[owner];
+        if (0 == offset) {
+            /* one message at a time is written into a ring */
+            if (k_noLink_ != client.receivingLink && linkIdx != client.receivingLink) {
+                return ISOTP_RET_NOSPACE;
+            }
+            rxData_[linkIdx] = client.channel.ToClient().Reserve(totalSize);
+            if (nullptr == rxData_[linkIdx]) {
+                return ISOTP_RET_NOSPACE;
+            }
+            client.receivingLink = static_cast<uint8_t>(linkIdx);
+        } else if (nullptr == rxData_[linkIdx]) {
+            /* the start of the message went to a client that is gone */
+            return ISOTP_RET_ERROR;
+        }
+
+        std::memcpy(rxData_[linkIdx] + offset, data, size);
+        if (offset + size == totalSize) {
+            client.receivingLink = k_noLink_;
+            rxData_[linkIdx] = nullptr;
+            if (client.channel.ToClient().Commit(PeerOf(linkIdx), totalSize)) {
+                IsoTpShmChannel::Wake(client.channel.ToClientEventFd());
+            }
+        }
+        return ISOTP_RET_OK;
+    }
+
+    static void OnEvent(IsoTpLink* link, IsoTpEventTypes event, int, void* arg) {
+        static_cast<IsoTpShmDaemon*>(arg)->HandleEvent(link, event);
+    }
+
+    void HandleEvent(IsoTpLink* link, IsoTpEventTypes event) {
+        std::size_t linkIdx = LinkIndex(link);
+
+        if (ISOTP_EVENT_RECEIVE_ERROR == event && ISOTP_RECEIVE_STATUS_INPROGRESS != link->receive_status) {
+            /* the reserved space is taken by the next message */
+            uint8_t owner = rxOwner_[linkIdx];
+            if (k_noClient_ != owner && clients_[owner].receivingLink == linkIdx) {
+                clients_[owner].receivingLink = k_noLink_;
+            }
+            return;
+        }
+        if ((ISOTP_EVENT_SEND_COMPLETE != event && ISOTP_EVENT_SEND_ERROR != event) || k_noClient_ == txClient_[linkIdx]) {
+            return;
+        }
+
+        std::size_t idx = txClient_[linkIdx];
+        Client& client = clients_[idx];
+        txClient_[linkIdx] = k_noClient_;
+        client.sending = false;
+        if (client.closing) {
+            CloseClient(idx);
+        } else {
+            (ISOTP_EVENT_SEND_COMPLETE == event ? client.channel.Header()->sendsCompleted : client.channel.Header()->sendsFailed).fetch_add(1);
+            ReleaseSent(idx, link->send_size);
+        }
+        if (!inSendNext_) {
+            /* the link is free again, the other clients waiting for it go first */
+            for (std::size_t next = 1; next <= MaxClients; ++next) {
+                std::size_t other = (idx + next) % MaxClients;
+                if (clients_[other].channel.IsOpen()) {
+                    SendNext(other);
+                }
+            }
+        }
+    }
+};
+
+#endif //ISOTP_SHM_H
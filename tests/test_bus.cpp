@@ -0,0 +1,116 @@
+#include <cstring>
+#include "test_bus.hpp"
+
+namespace isotp_test {
+
+std::deque<Frame> g_bus;
+uint32_t g_nowUs = 1000;
+int g_refuseSends = 0;
+IsoTpLink* g_refuseTo = nullptr;
+long g_framesSent = 0;
+
+static int g_failures = 0;
+
+void ResetBus() {
+    g_bus.clear();
+    g_refuseSends = 0;
+    g_refuseTo = nullptr;
+    g_framesSent = 0;
+}
+
+std::size_t Deliver() {
+    std::size_t count = 0;
+
+    while (!g_bus.empty()) {
+        Frame frame = g_bus.front();
+        g_bus.pop_front();
+        if (nullptr != frame.dst) {
+            isotp_on_can_message(frame.dst, frame.data, frame.len);
+        }
+        ++count;
+    }
+    return count;
+}
+
+static bool IsSettled(std::initializer_list<IsoTpLink*> links) {
+    if (!g_bus.empty()) {
+        return false;
+    }
+    for (IsoTpLink* link : links) {
+        if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status || ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int Run(std::initializer_list<IsoTpLink*> links, int steps, uint32_t stepUs) {
+    int step = 0;
+
+    for (; step < steps; ++step) {
+        Deliver();
+        for (IsoTpLink* link : links) {
+            isotp_poll(link);
+        }
+        g_nowUs += stepUs;
+        if (IsSettled(links)) {
+            break;
+        }
+    }
+    return step;
+}
+
+void ConnectLinks(IsoTpLink* a, IsoTpLink* b, uint8_t* aSend, uint8_t* aReceive, uint8_t* bSend, uint8_t* bReceive, uint16_t size) {
+    isotp_init_link(a, 0x100, 0x200);
+    isotp_init_link(b, 0x200, 0x100);
+    isotp_config_sendbuf(a, aSend, size);
+    isotp_config_rcvbuf(a, aReceive, size);
+    isotp_config_sendbuf(b, bSend, size);
+    isotp_config_rcvbuf(b, bReceive, size);
+    a->user_send_can_arg = b;
+    b->user_send_can_arg = a;
+}
+
+void Fail(const char* file, int line, const char* expression) {
+    std::printf("%s:%d: CHECK(%s) failed\n", file, line, expression);
+    ++g_failures;
+}
+
+int Report(const char* name) {
+    if (0 != g_failures) {
+        std::printf("%s: %d checks failed\n", name, g_failures);
+        return 1;
+    }
+    std::printf("%s: ok\n", name);
+    return 0;
+}
+
+} // namespace isotp_test
+
+extern "C" {
+
+void isotp_user_debug(const char* message, ...) {
+    (void) message;
+}
+
+uint32_t isotp_user_get_us(void) {
+    return isotp_test::g_nowUs;
+}
+
+int isotp_user_send_can(const uint32_t arbitration_id, const uint8_t* data, const uint8_t size, void* arg) {
+    isotp_test::Frame frame = {};
+
+    if (isotp_test::g_refuseSends > 0 && (nullptr == isotp_test::g_refuseTo || arg == isotp_test::g_refuseTo)) {
+        --isotp_test::g_refuseSends;
+        return ISOTP_RET_NOSPACE;
+    }
+    frame.id = arbitration_id;
+    frame.len = size;
+    std::memcpy(frame.data, data, size);
+    frame.dst = static_cast<IsoTpLink*>(arg);
+    isotp_test::g_bus.push_back(frame);
+    ++isotp_test::g_framesSent;
+    return ISOTP_RET_OK;
+}
+
+}
@@ -0,0 +1,60 @@
+#ifndef ISOTP_TEST_BUS_H
+#define ISOTP_TEST_BUS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <initializer_list>
+#include "isotp.h"
+
+/* Loopback CAN bus for the tests. isotp_user_send_can puts a frame on the bus,
+ * addressed to the IsoTpLink in user_send_can_arg, and Deliver hands the frames
+ * to their links in order. The clock only moves when a test advances it.
+ */
+namespace isotp_test {
+
+struct Frame {
+    uint32_t id;
+    uint8_t len;
+    uint8_t data[8];
+    IsoTpLink* dst;
+};
+
+extern std::deque<Frame> g_bus;
+extern uint32_t g_nowUs;
+extern int g_refuseSends;      /* number of upcoming sends answered with ISOTP_RET_NOSPACE */
+extern IsoTpLink* g_refuseTo;  /* if set, only frames to this link are refused */
+extern long g_framesSent;      /* frames put on the bus since the last ResetBus */
+
+void ResetBus();
+
+/* Hands all frames on the bus to isotp_on_can_message of their links.
+ * Return the number of frames delivered
+ */
+std::size_t Deliver();
+
+/* Delivers, polls the links and advances the clock by stepUs, until every link
+ * is idle or full and the bus is empty, or steps ran out.
+ * Return the number of steps taken
+ */
+int Run(std::initializer_list<IsoTpLink*> links, int steps = 100000, uint32_t stepUs = 10);
+
+/* Links a and b to each other with the given send and receive buffers */
+void ConnectLinks(IsoTpLink* a, IsoTpLink* b, uint8_t* aSend, uint8_t* aReceive, uint8_t* bSend, uint8_t* bReceive, uint16_t size);
+
+void Fail(const char* file, int line, const char* expression);
+
+/* Prints the result, return the exit code of the test */
+int Report(const char* name);
+
+} // namespace isotp_test
+
+#define CHECK(expression) \
+    do { \
+        if (!(expression)) { \
+            isotp_test::Fail(__FILE__, __LINE__, #expression); \
+        } \
+    } while (0)
+
+#endif //ISOTP_TEST_BUS_H
@@ -0,0 +1,353 @@
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "test_bus.hpp"
+#include "can_link_manager.hpp"
+#include "isotp_checkpoint.hpp"
+#include "isotp_lz.hpp"
+
+using namespace isotp_test;
+
+using Manager = CanLinkManager<uint8_t, uint8_t>;
+
+/* A process owning a manager with the address 1 and the peers 2 and 3 */
+struct Node {
+    Manager manager{uint8_t(1), uint8_t(2), uint8_t(3)};
+    uint8_t sendBuf[2][4095];
+    uint8_t receiveBuf[2][4095];
+    std::vector<std::vector<uint8_t>> received;
+    int errors = 0;
+};
+
+static IsoTpLink g_peer;
+static std::vector<std::vector<uint8_t>> g_peerReceived;
+static int g_peerErrors = 0;
+
+static void Collect(IsoTpLink* link, IsoTpEventTypes event, std::vector<std::vector<uint8_t>>& received, int& errors) {
+    if (ISOTP_EVENT_RECEIVE_COMPLETE == event) {
+        std::vector<uint8_t> message(4095);
+        uint16_t size;
+        if (ISOTP_RET_OK == isotp_receive(link, message.data(), static_cast<uint16_t>(message.size()), &size)) {
+            message.resize(size);
+            received.push_back(message);
+        }
+    } else if (ISOTP_EVENT_RECEIVE_ERROR == event || ISOTP_EVENT_SEND_ERROR == event) {
+        ++errors;
+    }
+}
+
+static void OnNodeEvent(IsoTpLink* link, IsoTpEventTypes event, int, void* arg) {
+    Node* node = static_cast<Node*>(arg);
+    Collect(link, event, node->received, node->errors);
+}
+
+static void OnPeerEvent(IsoTpLink* link, IsoTpEventTypes event, int, void*) {
+    Collect(link, event, g_peerReceived, g_peerErrors);
+}
+
+static std::unique_ptr<Node> StartNode() {
+    std::unique_ptr<Node> node(new Node);
+
+    for (int i = 0; i < 2; ++i) {
+        IsoTpLink& link = node->manager.GetIsotpLinks()[i];
+        isotp_config_sendbuf(&link, node->sendBuf[i], sizeof(node->sendBuf[i]));
+        isotp_config_rcvbuf(&link, node->receiveBuf[i], sizeof(node->receiveBuf[i]));
+    }
+    node->manager.SetEventCallback(OnNodeEvent, node.get());
+    IsoTpLink* link = node->manager.GetLinkFromPeerAddr(2);
+    link->user_send_can_arg = &g_peer;
+    g_peer.user_send_can_arg = link;
+    return node;
+}
+
+/* One frame per step, so a checkpoint can be taken between any two frames */
+static void Step(Node& node, int steps) {
+    for (int i = 0; i < steps; ++i) {
+        if (!g_bus.empty()) {
+            Frame frame = g_bus.front();
+            g_bus.pop_front();
+            isotp_on_can_message(frame.dst, frame.data, frame.len);
+        }
+        node.manager.Poll();
+        isotp_poll(&g_peer);
+        g_nowUs += 10;
+    }
+}
+
+/* The node's peer with the address 2 */
+static void StartPeer() {
+    static uint8_t peerSend[4095], peerReceive[4095];
+
+    ResetBus();
+    g_peerReceived.clear();
+    g_peerErrors = 0;
+    isotp_init_link(&g_peer, 0x400 | (1 << 5) | 2, 0x400 | (2 << 5) | 1);
+    isotp_config_sendbuf(&g_peer, peerSend, sizeof(peerSend));
+    isotp_config_rcvbuf(&g_peer, peerReceive, sizeof(peerReceive));
+    isotp_config_event_cb(&g_peer, OnPeerEvent, nullptr);
+}
+
+enum class Outcome {Delivered, Failed, Corrupted};
+
+/* Node 1 sends (or receives) a 2000 byte message to (from) the peer, saves its
+ * state after stopAfter steps and is restarted downtimeUs later. The frames sent
+ * to it meanwhile are lost.
+ */
+static Outcome RestartDuringTransfer(bool send, int stopAfter, uint32_t downtimeUs, const char* checkpointPath) {
+    std::vector<uint8_t> message(2000), region;
+
+    StartPeer();
+    for (std::size_t i = 0; i < message.size(); ++i) {
+        message[i] = static_cast<uint8_t>(i * 7 + 3);
+    }
+
+    std::unique_ptr<Node> node = StartNode();
+    if (send) {
+        CHECK(1 == node->manager.Send(2, message.data(), static_cast<uint16_t>(message.size())));
+    } else {
+        CHECK(1 == isotp_send(&g_peer, message.data(), static_cast<uint16_t>(message.size())));
+    }
+    Step(*node, stopAfter);
+
+    IsoTpLink* oldLink = node->manager.GetLinkFromPeerAddr(2);
+    if (nullptr != checkpointPath) {
+        CHECK(IsoTpCheckpoint::Save(checkpointPath, node->manager));
+    } else {
+        region.resize(node->manager.StateSize());
+        CHECK(0 != node->manager.SaveState(region.data(), region.size()));
+    }
+    node.reset();
+    for (uint32_t t = 0; t < downtimeUs; t += 10) {
+        while (!g_bus.empty()) {
+            Frame frame = g_bus.front();
+            g_bus.pop_front();
+            if (frame.dst != oldLink) {
+                isotp_on_can_message(frame.dst, frame.data, frame.len);
+            }
+        }
+        isotp_poll(&g_peer);
+        g_nowUs += 10;
+    }
+    g_bus.clear();
+
+    node = StartNode();
+    if (nullptr != checkpointPath) {
+        CHECK(IsoTpCheckpoint::Restore(checkpointPath, node->manager));
+    } else {
+        CHECK(node->manager.RestoreState(region.data(), region.size()));
+    }
+    Step(*node, 30000);
+
+    const std::vector<std::vector<uint8_t>>& received = send ? g_peerReceived : node->received;
+    if (1 == received.size() && message == received[0]) {
+        return Outcome::Delivered;
+    }
+    if (received.empty() && (0 != node->errors || 0 != g_peerErrors)) {
+        return Outcome::Failed;
+    }
+    return Outcome::Corrupted;
+}
+
+static void TestRestart(const std::string& checkpointPath) {
+    int delivered[2] = {0, 0}, failed[2] = {0, 0};
+
+    /* every checkpoint position either continues the transfer or fails it on one side, never
+     * delivers a wrong message; a sender between consecutive frames continues
+     */
+    for (int send = 0; send < 2; ++send) {
+        for (int stop = 1; stop <= 120; ++stop) {
+            Outcome outcome = RestartDuringTransfer(1 == send, stop, 30000, 0 == stop % 2 ? checkpointPath.c_str() : nullptr);
+            CHECK(Outcome::Corrupted != outcome);
+            delivered[send] += Outcome::Delivered == outcome ? 1 : 0;
+            failed[send] += Outcome::Failed == outcome ? 1 : 0;
+        }
+    }
+    CHECK(delivered[1] > 0);
+    std::printf("restart while receiving: %d continued, %d failed\n", delivered[0], failed[0]);
+    std::printf("restart while sending: %d continued, %d failed\n", delivered[1], failed[1]);
+
+    /* longer than N_Bs, the peer gave up */
+    CHECK(Outcome::Failed == RestartDuringTransfer(true, 20, 150000, nullptr));
+    CHECK(Outcome::Failed == RestartDuringTransfer(false, 20, 150000, nullptr));
+
+    /* Restore takes the file only once */
+    struct stat info;
+    std::unique_ptr<Node> node = StartNode();
+    CHECK(!IsoTpCheckpoint::Restore(checkpointPath.c_str(), node->manager));
+    CHECK(0 != stat(checkpointPath.c_str(), &info));
+}
+
+/* other addresses, smaller buffers, a clock that went backwards, corrupt and cut regions */
+static void TestRejected() {
+    std::unique_ptr<Node> node = StartNode();
+    uint8_t payload[100] = {1};
+    std::vector<uint8_t> region(node->manager.StateSize());
+
+    ResetBus();
+    CHECK(1 == node->manager.Send(2, payload, sizeof(payload)));
+    std::size_t size = node->manager.SaveState(region.data(), region.size());
+    CHECK(size > 0 && 0 == node->manager.SaveState(region.data(), region.size() - 1));
+    region.resize(size);
+
+    CanLinkManager<uint8_t, uint8_t> otherPeers(uint8_t(1), uint8_t(2), uint8_t(4));
+    CanLinkManager<uint8_t> fewerPeers(uint8_t(1), uint8_t(2));
+    CHECK(!otherPeers.RestoreState(region.data(), size) && !fewerPeers.RestoreState(region.data(), size));
+
+    std::unique_ptr<Node> restarted = StartNode();
+    IsoTpLink* link = restarted->manager.GetLinkFromPeerAddr(2);
+    g_nowUs -= 1000;
+    CHECK(!restarted->manager.RestoreState(region.data(), size));
+    g_nowUs += 1000;
+    isotp_config_sendbuf(link, restarted->sendBuf[0], 50);
+    CHECK(!restarted->manager.RestoreState(region.data(), size));
+    isotp_config_sendbuf(link, restarted->sendBuf[0], sizeof(restarted->sendBuf[0]));
+    CHECK(ISOTP_SEND_STATUS_IDLE == link->send_status);
+
+    /* header.size is the only header field equal to the saved size */
+    std::size_t sizeOffset = 0;
+    for (; sizeOffset + 4 <= 32; ++sizeOffset) {
+        uint32_t value;
+        std::memcpy(&value, region.data() + sizeOffset, sizeof(value));
+        if (size == value) {
+            break;
+        }
+    }
+    CHECK(sizeOffset + 4 <= 32);
+    for (uint32_t badSize : {0u, 1u, 10u, 20u, static_cast<uint32_t>(size - 1), static_cast<uint32_t>(size + 1), 0xFFFFFFFFu}) {
+        std::vector<uint8_t> corrupt(region);
+        std::memcpy(corrupt.data() + sizeOffset, &badSize, sizeof(badSize));
+        CHECK(!restarted->manager.RestoreState(corrupt.data(), corrupt.size()));
+    }
+    for (std::size_t cut = 0; cut < size; ++cut) {
+        std::vector<uint8_t> truncated(region.begin(), region.begin() + cut);
+        CHECK(!restarted->manager.RestoreState(truncated.data(), truncated.size()));
+    }
+    CHECK(ISOTP_SEND_STATUS_IDLE == link->send_status);
+
+    CHECK(restarted->manager.RestoreState(region.data(), size));
+    CHECK(ISOTP_SEND_STATUS_INPROGRESS == link->send_status);
+    g_bus.clear();
+}
+
+/* A reception saved in the middle of a 2000 byte message only resumes into a
+ * link that can hold it, and no corrupted byte of the image leaves a link with
+ * sizes or offsets beyond its buffers
+ */
+static void TestReceiveState() {
+    uint8_t message[2000] = {0};
+    static uint8_t smallReceive[64];
+
+    StartPeer();
+    std::unique_ptr<Node> node = StartNode();
+    IsoTpLink* link = node->manager.GetLinkFromPeerAddr(2);
+    CHECK(1 == isotp_send(&g_peer, message, sizeof(message)));
+    for (int step = 0; step < 1000 && link->receive_offset < 200; ++step) {
+        Step(*node, 1);
+    }
+    CHECK(ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status && link->receive_offset >= 200);
+    std::vector<uint8_t> region(node->manager.StateSize());
+    std::size_t size = node->manager.SaveState(region.data(), region.size());
+    CHECK(size > 0);
+    region.resize(size);
+    node.reset();
+
+    std::unique_ptr<Node> restarted = StartNode();
+    link = restarted->manager.GetLinkFromPeerAddr(2);
+    isotp_config_rcvbuf(link, smallReceive, sizeof(smallReceive));
+    CHECK(!restarted->manager.RestoreState(region.data(), size));
+    CHECK(ISOTP_RECEIVE_STATUS_IDLE == link->receive_status);
+    isotp_config_rcvbuf(link, restarted->receiveBuf[0], sizeof(restarted->receiveBuf[0]));
+    isotp_config_rcv_stream(link, [](IsoTpLink*, const uint8_t*, uint16_t, uint16_t, uint16_t, void*) {return ISOTP_RET_OK;}, nullptr);
+    CHECK(!restarted->manager.RestoreState(region.data(), size));
+    isotp_config_rcv_stream(link, nullptr, nullptr);
+
+    for (std::size_t i = 0; i < size; ++i) {
+        for (uint8_t value : {uint8_t(0xFF), static_cast<uint8_t>(region[i] + 1)}) {
+            std::vector<uint8_t> corrupt(region);
+            corrupt[i] = value;
+            std::unique_ptr<Node> other = StartNode();
+            if (!other->manager.RestoreState(corrupt.data(), corrupt.size())) {
+                continue;
+            }
+            for (const IsoTpLink& restored : other->manager.GetIsotpLinks()) {
+                CHECK(restored.send_status <= ISOTP_SEND_STATUS_ERROR && restored.receive_status <= ISOTP_RECEIVE_STATUS_FULL);
+                CHECK(ISOTP_SEND_STATUS_INPROGRESS != restored.send_status ||
+                      (restored.send_size <= restored.send_buf_size && restored.send_offset <= restored.send_size));
+                CHECK(ISOTP_RECEIVE_STATUS_IDLE == restored.receive_status ||
+                      (restored.receive_size <= restored.receive_buf_size && restored.receive_offset <= restored.receive_size));
+            }
+        }
+    }
+
+    CHECK(restarted->manager.RestoreState(region.data(), size));
+    CHECK(ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status);
+    ResetBus();
+}
+
+/* the negotiated compression survives a restart only if the codec is set before RestoreState */
+static void TestCompression() {
+    static uint8_t peerSend[4095], peerReceive[4095], scratch[2][4095];
+    static IsoTpLz<> codec, peerCodec, restartedCodec;
+    CanLinkManager<uint8_t> peer(uint8_t(2), uint8_t(1));
+    IsoTpLink* peerLink = peer.GetLinkFromPeerAddr(1);
+    std::vector<uint8_t> message(2000, 'x');
+    uint8_t out[4095];
+    uint16_t outSize;
+
+    ResetBus();
+    isotp_config_sendbuf(peerLink, peerSend, sizeof(peerSend));
+    isotp_config_rcvbuf(peerLink, peerReceive, sizeof(peerReceive));
+    peer.SetCompressionCodec(peerCodec, scratch[0], sizeof(scratch[0]));
+
+    std::unique_ptr<Node> node;
+    auto pump = [&node, &peer]() {
+        for (int i = 0; i < 5000; ++i) {
+            Deliver();
+            node->manager.Poll();
+            peer.Poll();
+            g_nowUs += 10;
+        }
+    };
+    node = StartNode();
+    node->manager.GetLinkFromPeerAddr(2)->user_send_can_arg = peerLink;
+    peerLink->user_send_can_arg = node->manager.GetLinkFromPeerAddr(2);
+    node->manager.SetCompressionCodec(codec, scratch[1], sizeof(scratch[1]));
+    CHECK(node->manager.EnableCompression(2, 64) && peer.EnableCompression(1, 64));
+    pump();
+    CHECK(node->manager.IsCompressionActive(2));
+    std::vector<uint8_t> region(node->manager.StateSize());
+    std::size_t size = node->manager.SaveState(region.data(), region.size());
+    node.reset();
+
+    for (bool withCodec : {true, false}) {
+        node = StartNode();
+        IsoTpLink* link = node->manager.GetLinkFromPeerAddr(2);
+        link->user_send_can_arg = peerLink;
+        peerLink->user_send_can_arg = link;
+        if (withCodec) {
+            node->manager.SetCompressionCodec(restartedCodec, scratch[1], sizeof(scratch[1]));
+        }
+        CHECK(node->manager.RestoreState(region.data(), size));
+        CHECK(withCodec == node->manager.IsCompressionActive(2));
+
+        long before = g_framesSent;
+        CHECK(1 == node->manager.Send(2, message.data(), static_cast<uint16_t>(message.size())));
+        pump();
+        CHECK(ISOTP_RET_OK == peer.Receive(1, out, sizeof(out), &outSize));
+        CHECK(message.size() == outSize && 0 == std::memcmp(out, message.data(), outSize));
+        std::printf("restart %s codec: %ld frames\n", withCodec ? "with" : "without", g_framesSent - before);
+        node.reset();
+    }
+}
+
+int main() {
+    std::string checkpointPath = "/tmp/isotp_test_ckpt_" + std::to_string(getpid());
+
+    TestRestart(checkpointPath);
+    TestRejected();
+    TestReceiveState();
+    TestCompression();
+    return Report("test_checkpoint");
+}
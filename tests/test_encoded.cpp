@@ -0,0 +1,96 @@
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "test_bus.hpp"
+
+using namespace isotp_test;
+
+static uint8_t aSend[4095], aReceive[4095], bSend[4095], bReceive[4095];
+static IsoTpLink a, b;
+static uint8_t g_message[4095];
+static IsoTpCanFrame g_frames[600];
+
+/* Runs the started send from a to b, keeps the frames that reached b.
+ * Return the number of polls until the message was received
+ */
+static int Transfer(std::vector<Frame>& toReceiver) {
+    int polls = 0;
+
+    toReceiver.clear();
+    for (; polls < 100000; ++polls) {
+        if (ISOTP_SEND_STATUS_IDLE == a.send_status && ISOTP_RECEIVE_STATUS_FULL == b.receive_status) {
+            break;
+        }
+        while (!g_bus.empty()) {
+            Frame frame = g_bus.front();
+            g_bus.pop_front();
+            if (frame.dst == &b) {
+                toReceiver.push_back(frame);
+            }
+            isotp_on_can_message(frame.dst, frame.data, frame.len);
+        }
+        isotp_poll(&a);
+        isotp_poll(&b);
+        g_nowUs += 10;
+    }
+    return polls;
+}
+
+static bool SameFrames(const std::vector<Frame>& x, const std::vector<Frame>& y) {
+    if (x.size() != y.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < x.size(); ++i) {
+        if (x[i].id != y[i].id || x[i].len != y[i].len || 0 != std::memcmp(x[i].data, y[i].data, x[i].len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    std::vector<Frame> sent, encoded;
+    uint8_t out[4095];
+    uint16_t outSize;
+
+    ConnectLinks(&a, &b, aSend, aReceive, bSend, bReceive, sizeof(aSend));
+    std::srand(1);
+    for (auto& byte : g_message) {
+        byte = static_cast<uint8_t>(std::rand());
+    }
+
+    /* single frame up to 7 bytes, then a first frame with 6 and consecutive frames with 7 bytes */
+    CHECK(1 == ISOTP_ENCODED_FRAME_COUNT(1) && 1 == ISOTP_ENCODED_FRAME_COUNT(7));
+    CHECK(2 == ISOTP_ENCODED_FRAME_COUNT(8) && 2 == ISOTP_ENCODED_FRAME_COUNT(13));
+    CHECK(3 == ISOTP_ENCODED_FRAME_COUNT(14) && 586 == ISOTP_ENCODED_FRAME_COUNT(4095));
+    CHECK(ISOTP_RET_OVERFLOW == isotp_encode_frames(g_message, 0, g_frames, 600));
+    CHECK(ISOTP_RET_OVERFLOW == isotp_encode_frames(g_message, 4096, g_frames, 600));
+
+    for (uint16_t size : {1, 7, 8, 13, 14, 100, 111, 4095}) {
+        int count = isotp_encode_frames(g_message, size, g_frames, 600);
+
+        CHECK(ISOTP_ENCODED_FRAME_COUNT(size) == count);
+        CHECK(ISOTP_RET_OVERFLOW == isotp_encode_frames(g_message, size, g_frames, static_cast<uint16_t>(count - 1)));
+
+        /* the frames of isotp_send are the reference */
+        CHECK(1 == isotp_send(&a, g_message, size));
+        int sendPolls = Transfer(sent);
+        CHECK(ISOTP_RET_OK == isotp_receive(&b, out, sizeof(out), &outSize) && size == outSize);
+
+        /* the same frames array sent twice */
+        for (int repeat = 0; repeat < 2; ++repeat) {
+            isotp_send_encoded(&a, g_frames, static_cast<uint16_t>(count));
+            int encodedPolls = Transfer(encoded);
+            CHECK(ISOTP_RET_OK == isotp_receive(&b, out, sizeof(out), &outSize));
+            CHECK(size == outSize && 0 == std::memcmp(out, g_message, size));
+            CHECK(SameFrames(sent, encoded));
+            if (0 == repeat) {
+                std::printf("size %4u: %3d frames encoded, %3d polls with isotp_send, %3d with isotp_send_encoded\n",
+                            static_cast<unsigned>(size), count, sendPolls, encodedPolls);
+            }
+        }
+    }
+
+    CHECK(0 == isotp_send_encoded(&a, nullptr, 1) && ISOTP_SEND_STATUS_IDLE == a.send_status);
+    return Report("test_encoded");
+}
@@ -0,0 +1,111 @@
+#include <cstring>
+#include <vector>
+#include "test_bus.hpp"
+
+using namespace isotp_test;
+
+static uint8_t aSend[4095], aReceive[4095], bSend[4095], bReceive[4095];
+static IsoTpLink a, b;
+static uint8_t g_message[100];
+
+/* an event as the callback saw it */
+struct Event {
+    IsoTpLink* link;
+    IsoTpEventTypes event;
+    int protocolResult;
+    uint32_t timeUs;
+    uint8_t sendStatus;
+    uint16_t received; /* bytes isotp_receive returned within the callback */
+};
+static std::vector<Event> g_events;
+
+static void OnEvent(IsoTpLink* link, IsoTpEventTypes event, int protocolResult, void*) {
+    uint8_t out[4095];
+    uint16_t outSize = 0;
+
+    if (ISOTP_EVENT_RECEIVE_COMPLETE == event) {
+        CHECK(ISOTP_RET_OK == isotp_receive(link, out, sizeof(out), &outSize));
+        CHECK(0 == std::memcmp(out, g_message, outSize));
+    }
+    g_events.push_back({link, event, protocolResult, g_nowUs, link->send_status, outSize});
+}
+
+/* Delivers, polls a and b and advances the clock, until both are idle. The frames
+ * to b after the first dropAfter are lost.
+ */
+static void Transfer(long dropAfter = -1) {
+    long toB = 0;
+
+    for (int step = 0; step < 100000; ++step) {
+        while (!g_bus.empty()) {
+            Frame frame = g_bus.front();
+            g_bus.pop_front();
+            if (&b == frame.dst && dropAfter >= 0 && toB++ >= dropAfter) {
+                continue;
+            }
+            isotp_on_can_message(frame.dst, frame.data, frame.len);
+        }
+        isotp_poll(&a);
+        isotp_poll(&b);
+        g_nowUs += 10;
+        if (ISOTP_SEND_STATUS_INPROGRESS != a.send_status && ISOTP_RECEIVE_STATUS_INPROGRESS != b.receive_status && g_bus.empty()) {
+            break;
+        }
+    }
+}
+
+static bool Is(const Event& event, IsoTpLink* link, IsoTpEventTypes type, int protocolResult) {
+    return event.link == link && event.event == type && event.protocolResult == protocolResult;
+}
+
+int main() {
+    ConnectLinks(&a, &b, aSend, aReceive, bSend, bReceive, sizeof(aSend));
+    isotp_config_event_cb(&a, OnEvent, nullptr);
+    isotp_config_event_cb(&b, OnEvent, nullptr);
+    for (std::size_t i = 0; i < sizeof(g_message); ++i) {
+        g_message[i] = static_cast<uint8_t>(i * 7);
+    }
+    ResetBus();
+
+    /* single frame: the send completes when the frame went out, then the receiver has it */
+    CHECK(1 == isotp_send(&a, g_message, 7));
+    Transfer();
+    CHECK(2 == g_events.size());
+    if (2 == g_events.size()) {
+        CHECK(Is(g_events[0], &a, ISOTP_EVENT_SEND_COMPLETE, ISOTP_PROTOCOL_RESULT_OK));
+        CHECK(Is(g_events[1], &b, ISOTP_EVENT_RECEIVE_COMPLETE, ISOTP_PROTOCOL_RESULT_OK) && 7 == g_events[1].received);
+    }
+
+    /* multi-frame: nothing until the last consecutive frame, the sender is idle in its callback */
+    g_events.clear();
+    CHECK(1 == isotp_send(&a, g_message, sizeof(g_message)));
+    Transfer();
+    CHECK(2 == g_events.size());
+    if (2 == g_events.size()) {
+        CHECK(Is(g_events[0], &a, ISOTP_EVENT_SEND_COMPLETE, ISOTP_PROTOCOL_RESULT_OK));
+        CHECK(ISOTP_SEND_STATUS_IDLE == g_events[0].sendStatus);
+        CHECK(Is(g_events[1], &b, ISOTP_EVENT_RECEIVE_COMPLETE, ISOTP_PROTOCOL_RESULT_OK));
+        CHECK(sizeof(g_message) == g_events[1].received && g_events[0].timeUs <= g_events[1].timeUs);
+    }
+
+    /* the frames after the first block's flow control are lost: the receiver's N_Cr
+     * runs out first, N_Bs of the sender, which sent two frames more, afterwards
+     */
+    g_events.clear();
+    uint32_t start = g_nowUs;
+    CHECK(1 == isotp_send(&a, g_message, sizeof(g_message)));
+    Transfer(2);
+    CHECK(2 == g_events.size());
+    if (2 == g_events.size()) {
+        CHECK(Is(g_events[0], &b, ISOTP_EVENT_RECEIVE_ERROR, ISOTP_PROTOCOL_RESULT_TIMEOUT_CR));
+        CHECK(Is(g_events[1], &a, ISOTP_EVENT_SEND_ERROR, ISOTP_PROTOCOL_RESULT_TIMEOUT_BS));
+        CHECK(ISOTP_SEND_STATUS_ERROR == g_events[1].sendStatus);
+        CHECK(g_events[0].timeUs > start + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US &&
+              g_events[0].timeUs <= start + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US + 100);
+        CHECK(g_events[1].timeUs > g_events[0].timeUs && g_events[1].timeUs <= g_events[0].timeUs + 100);
+        std::printf("timeouts: N_Cr after %u us, N_Bs after %u us\n", static_cast<unsigned>(g_events[0].timeUs - start),
+                    static_cast<unsigned>(g_events[1].timeUs - start));
+    }
+
+    return Report("test_events");
+}
@@ -0,0 +1,99 @@
+#include <cstring>
+#include <vector>
+#include "test_bus.hpp"
+
+using namespace isotp_test;
+
+static int g_receiveErrors = 0;
+static int g_sendErrors = 0;
+static int g_lastReceiveResult = 0;
+
+static void OnEvent(IsoTpLink*, IsoTpEventTypes event, int protocolResult, void*) {
+    if (ISOTP_EVENT_RECEIVE_ERROR == event) {
+        ++g_receiveErrors;
+        g_lastReceiveResult = protocolResult;
+    } else if (ISOTP_EVENT_SEND_ERROR == event) {
+        ++g_sendErrors;
+    }
+}
+
+static bool g_consumerBusy = true;
+static std::vector<uint8_t> g_received;
+
+static int OnChunk(IsoTpLink*, const uint8_t* data, uint16_t, uint16_t size, uint16_t, void*) {
+    if (g_consumerBusy) {
+        return ISOTP_RET_NOSPACE;
+    }
+    g_received.insert(g_received.end(), data, data + size);
+    return ISOTP_RET_OK;
+}
+
+/* the receiver may wait this long before it gives up */
+static constexpr int k_waitLimitMs = ISO_TP_MAX_WFT_NUMBER * ISO_TP_WAIT_INTERVAL_US / 1000;
+
+/* deliver and poll every millisecond */
+static void Step(IsoTpLink* a, IsoTpLink* b, int ms) {
+    for (int i = 0; i < ms; ++i) {
+        Deliver();
+        isotp_poll(a);
+        isotp_poll(b);
+        g_nowUs += 1000;
+    }
+}
+
+int main() {
+    static uint8_t aSend[256], aReceive[256], bSend[256], bReceive[256];
+    IsoTpLink a, b;
+    uint8_t first[40], second[40], out[256];
+    uint16_t outSize;
+
+    for (int i = 0; i < 40; ++i) {
+        first[i] = static_cast<uint8_t>(i);
+        second[i] = static_cast<uint8_t>(100 + i);
+    }
+    ConnectLinks(&a, &b, aSend, aReceive, bSend, bReceive, sizeof(aSend));
+    isotp_config_event_cb(&a, OnEvent, nullptr);
+    isotp_config_event_cb(&b, OnEvent, nullptr);
+
+    /* a first frame arriving while the last message is unread is held with FC.WAIT */
+    isotp_send(&a, first, sizeof(first));
+    Step(&a, &b, 20);
+    CHECK(ISOTP_RECEIVE_STATUS_FULL == b.receive_status);
+    isotp_send(&a, second, sizeof(second));
+    Step(&a, &b, k_waitLimitMs - 10);
+    CHECK(b.receive_ff_held && ISOTP_SEND_STATUS_INPROGRESS == a.send_status);
+    CHECK(isotp_poll_us(&b) > 0 && isotp_poll_us(&b) <= ISO_TP_WAIT_INTERVAL_US);
+    CHECK(ISOTP_RET_OK == isotp_receive(&b, out, sizeof(out), &outSize));
+    CHECK(sizeof(first) == outSize && 0 == std::memcmp(out, first, outSize));
+    Step(&a, &b, 20);
+    CHECK(ISOTP_RET_OK == isotp_receive(&b, out, sizeof(out), &outSize));
+    CHECK(sizeof(second) == outSize && 0 == std::memcmp(out, second, outSize));
+    CHECK(0 == g_receiveErrors && 0 == g_sendErrors);
+
+    /* never read: after ISO_TP_MAX_WFT_NUMBER FC.WAIT frames the held message is dropped */
+    isotp_send(&a, first, sizeof(first));
+    Step(&a, &b, 20);
+    isotp_send(&a, second, sizeof(second));
+    Step(&a, &b, k_waitLimitMs + ISO_TP_WAIT_INTERVAL_US / 1000 + 10);
+    CHECK(1 == g_receiveErrors && ISOTP_PROTOCOL_RESULT_WFT_OVRN == g_lastReceiveResult && 1 == g_sendErrors);
+    CHECK(ISOTP_RECEIVE_STATUS_FULL == b.receive_status && !b.receive_ff_held);
+    CHECK(ISOTP_RET_OK == isotp_receive(&b, out, sizeof(out), &outSize));
+    CHECK(sizeof(first) == outSize && 0 == std::memcmp(out, first, outSize));
+    Step(&a, &b, 2);
+
+    /* a streaming consumer that can't take data keeps the sender waiting instead of failing it */
+    static uint8_t stage[14];
+    g_receiveErrors = 0;
+    g_sendErrors = 0;
+    isotp_config_rcvbuf(&b, stage, sizeof(stage));
+    isotp_config_rcv_stream(&b, OnChunk, nullptr);
+    isotp_send(&a, first, sizeof(first));
+    Step(&a, &b, k_waitLimitMs - 10);
+    CHECK(ISOTP_SEND_STATUS_INPROGRESS == a.send_status && ISOTP_RECEIVE_STATUS_INPROGRESS == b.receive_status);
+    g_consumerBusy = false;
+    Step(&a, &b, 10);
+    CHECK(sizeof(first) == g_received.size() && 0 == std::memcmp(g_received.data(), first, sizeof(first)));
+    CHECK(0 == g_receiveErrors && 0 == g_sendErrors && ISOTP_SEND_STATUS_IDLE == a.send_status);
+
+    return Report("test_fc_wait");
+}
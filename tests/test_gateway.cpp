@@ -0,0 +1,179 @@
+#include <cstring>
+#include <vector>
+#include "test_bus.hpp"
+#include "isotp_gateway.hpp"
+
+using namespace isotp_test;
+
+/* The tester sends to the gateway's inbound link, the gateway forwards on its
+ * outbound link to the vehicle.
+ */
+static IsoTpLink g_tester, g_inbound, g_outbound, g_vehicle;
+static uint8_t g_message[1000];
+
+static constexpr uint8_t k_fcContinue = 0x30;
+static constexpr uint8_t k_fcWait = 0x31;
+
+/* what went over the two buses */
+struct Trace {
+    std::vector<uint32_t> toVehicle;   /* time of each frame the gateway forwarded */
+    std::vector<uint32_t> fromTester;  /* time of each frame the tester sent */
+    std::vector<uint8_t> toTesterFc;   /* flow status of each flow control frame to the tester */
+};
+
+/* One step of 10 us. While vehicleBusy, frames to the vehicle are refused by the driver */
+template <std::size_t RingSize>
+static void Step(IsoTpGateway<RingSize>& gateway, Trace& trace, bool vehicleBusy) {
+    g_refuseTo = &g_vehicle;
+    g_refuseSends = vehicleBusy ? 1 << 30 : 0;
+    while (!g_bus.empty()) {
+        Frame frame = g_bus.front();
+        g_bus.pop_front();
+        if (frame.dst == &g_inbound) {
+            trace.fromTester.push_back(g_nowUs);
+            gateway.OnInboundCanMessage(frame.data, frame.len);
+        } else if (frame.dst == &g_outbound) {
+            gateway.OnOutboundCanMessage(frame.data, frame.len);
+        } else {
+            if (frame.dst == &g_vehicle) {
+                trace.toVehicle.push_back(g_nowUs);
+            } else if (0x30 == (frame.data[0] & 0xF0)) {
+                trace.toTesterFc.push_back(frame.data[0]);
+            }
+            isotp_on_can_message(frame.dst, frame.data, frame.len);
+        }
+    }
+    isotp_poll(&g_tester);
+    gateway.Poll();
+    isotp_poll(&g_vehicle);
+    g_nowUs += 10;
+}
+
+template <std::size_t RingSize>
+static void CheckForwarded(IsoTpGateway<RingSize>& gateway, Trace& trace, int busySteps) {
+    uint8_t out[4095];
+    uint16_t outSize;
+
+    CHECK(1 == isotp_send(&g_tester, g_message, sizeof(g_message)));
+    for (int step = 0; step < 100000 && ISOTP_RECEIVE_STATUS_FULL != g_vehicle.receive_status; ++step) {
+        Step(gateway, trace, step >= 20 && step < 20 + busySteps);
+    }
+    CHECK(ISOTP_RET_OK == isotp_receive(&g_vehicle, out, sizeof(out), &outSize));
+    CHECK(sizeof(g_message) == outSize && 0 == std::memcmp(out, g_message, outSize));
+    CHECK(ISOTP_SEND_STATUS_IDLE == g_tester.send_status && ISOTP_SEND_STATUS_IDLE == g_outbound.send_status);
+    CHECK(ISOTP_RECEIVE_STATUS_IDLE == g_inbound.receive_status);
+    CHECK(ISOTP_ENCODED_FRAME_COUNT(sizeof(g_message)) == trace.toVehicle.size());
+}
+
+static void TestGateway() {
+    static uint8_t testerSend[4095], testerReceive[4095], inboundSend[8], inboundReceive[64];
+    static uint8_t outboundSend[8], outboundReceive[8], vehicleSend[4095], vehicleReceive[4095];
+
+    isotp_init_link(&g_tester, 0x100, 0x101);
+    isotp_init_link(&g_inbound, 0x101, 0x100);
+    isotp_init_link(&g_outbound, 0x200, 0x201);
+    isotp_init_link(&g_vehicle, 0x201, 0x200);
+    isotp_config_sendbuf(&g_tester, testerSend, sizeof(testerSend));
+    isotp_config_rcvbuf(&g_tester, testerReceive, sizeof(testerReceive));
+    isotp_config_sendbuf(&g_inbound, inboundSend, sizeof(inboundSend));
+    isotp_config_rcvbuf(&g_inbound, inboundReceive, sizeof(inboundReceive));
+    isotp_config_sendbuf(&g_outbound, outboundSend, sizeof(outboundSend));
+    isotp_config_rcvbuf(&g_outbound, outboundReceive, sizeof(outboundReceive));
+    isotp_config_sendbuf(&g_vehicle, vehicleSend, sizeof(vehicleSend));
+    isotp_config_rcvbuf(&g_vehicle, vehicleReceive, sizeof(vehicleReceive));
+    g_tester.user_send_can_arg = &g_inbound;
+    g_inbound.user_send_can_arg = &g_tester;
+    g_outbound.user_send_can_arg = &g_vehicle;
+    g_vehicle.user_send_can_arg = &g_outbound;
+    for (std::size_t i = 0; i < sizeof(g_message); ++i) {
+        g_message[i] = static_cast<uint8_t>(i * 7);
+    }
+    ResetBus();
+    IsoTpGateway<64> gateway(&g_inbound, &g_outbound);
+
+    /* cut-through: every frame leaves in the step it arrived */
+    Trace trace;
+    CheckForwarded(gateway, trace, 0);
+    CHECK(trace.fromTester.size() == trace.toVehicle.size());
+    for (std::size_t i = 0; i < trace.fromTester.size() && i < trace.toVehicle.size(); ++i) {
+        CHECK(trace.fromTester[i] == trace.toVehicle[i]);
+    }
+    for (uint8_t status : trace.toTesterFc) {
+        CHECK(k_fcContinue == status);
+    }
+    std::printf("cut-through: %zu frames, last one forwarded %u us after it arrived\n", trace.toVehicle.size(),
+                static_cast<unsigned>(trace.toVehicle.back() - trace.fromTester.back()));
+
+    /* the vehicle bus refuses frames for 20 ms: the ring and the inbound staging fill up,
+     * the tester is told to wait and resumes once the vehicle bus takes frames again
+     */
+    trace = Trace();
+    CheckForwarded(gateway, trace, 2000);
+    std::size_t waits = 0, continuesAfterWait = 0;
+    for (uint8_t status : trace.toTesterFc) {
+        waits += k_fcWait == status ? 1 : 0;
+        continuesAfterWait += 0 != waits && k_fcContinue == status ? 1 : 0;
+        CHECK(k_fcWait == status || k_fcContinue == status);
+    }
+    std::printf("back-pressure: %zu FC.WAIT, %zu FC.CTS after the first wait\n", waits, continuesAfterWait);
+    CHECK(waits >= 1 && continuesAfterWait >= 1);
+    CHECK(trace.fromTester.size() == trace.toVehicle.size());
+}
+
+static bool g_consumerReady;
+static std::vector<uint8_t> g_consumed;
+
+static int OnChunk(IsoTpLink*, const uint8_t* data, uint16_t offset, uint16_t size, uint16_t, void*) {
+    if (!g_consumerReady) {
+        return ISOTP_RET_NOSPACE;
+    }
+    CHECK(offset == g_consumed.size());
+    g_consumed.insert(g_consumed.end(), data, data + size);
+    return ISOTP_RET_OK;
+}
+
+/* a consumer that got ready hands over the staged data and sends the held back CTS right away */
+static void TestReceiveResume() {
+    static uint8_t aSend[4095], aReceive[4095], bSend[4095], bReceive[4095];
+    static IsoTpLink a, b;
+
+    ConnectLinks(&a, &b, aSend, aReceive, bSend, bReceive, sizeof(aSend));
+    isotp_config_rcvbuf(&b, bReceive, 28);
+    isotp_config_rcv_stream(&b, OnChunk, nullptr);
+    ResetBus();
+    g_consumerReady = false;
+    g_consumed.clear();
+
+    CHECK(0 == isotp_receive_resume(&b));
+    CHECK(1 == isotp_send(&a, g_message, 200));
+    for (int step = 0; step < 1000 && 0 == b.receive_fc_pending; ++step) {
+        Deliver();
+        isotp_poll(&a);
+        isotp_poll(&b);
+        g_nowUs += 10;
+    }
+    Deliver();
+    CHECK(1 == b.receive_fc_pending && 0 != b.receive_stage_size);
+    CHECK(g_bus.empty());
+
+    /* nothing changes while the consumer still refuses */
+    uint16_t staged = b.receive_stage_size;
+    CHECK(1 == isotp_receive_resume(&b));
+    CHECK(g_bus.empty() && staged == b.receive_stage_size && g_consumed.empty());
+
+    g_consumerReady = true;
+    CHECK(1 == isotp_receive_resume(&b));
+    CHECK(0 == b.receive_stage_size && 0 == b.receive_fc_pending && staged == g_consumed.size());
+    CHECK(1 == g_bus.size() && &a == g_bus.front().dst && k_fcContinue == g_bus.front().data[0]);
+
+    Run({&a, &b});
+    CHECK(ISOTP_RECEIVE_STATUS_IDLE == b.receive_status && ISOTP_SEND_STATUS_IDLE == a.send_status);
+    CHECK(200 == g_consumed.size() && 0 == std::memcmp(g_consumed.data(), g_message, 200));
+    CHECK(0 == isotp_receive_resume(&b));
+}
+
+int main() {
+    TestGateway();
+    TestReceiveResume();
+    return Report("test_gateway");
+}
@@ -0,0 +1,264 @@
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include "test_bus.hpp"
+#include "can_link_manager.hpp"
+#include "isotp_lz.hpp"
+
+using namespace isotp_test;
+
+using Lz = IsoTpLz<>;
+
+static constexpr uint8_t k_canary = 0xA5;
+
+/* Decompresses into capacity bytes followed by canaries, checks that none was overwritten.
+ * Return what Decompress returned
+ */
+static int DecompressGuarded(const uint8_t* src, std::size_t size, std::size_t capacity) {
+    std::vector<uint8_t> dst(capacity + 16, k_canary);
+    int result = Lz::Decompress(src, size, dst.data(), capacity);
+
+    for (std::size_t i = capacity; i < dst.size(); ++i) {
+        CHECK(k_canary == dst[i]);
+    }
+    CHECK(-1 == result || (result >= 0 && static_cast<std::size_t>(result) <= capacity));
+    return result;
+}
+
+static void TestCodec() {
+    Lz lz;
+
+    /* random, few distinct bytes and repeating runs of every size */
+    std::srand(1);
+    for (int iteration = 0; iteration < 3000; ++iteration) {
+        uint16_t size = static_cast<uint16_t>(std::rand() % 4096);
+        int mode = std::rand() % 3;
+        std::vector<uint8_t> payload(size);
+        for (uint16_t i = 0; i < size; ++i) {
+            payload[i] = static_cast<uint8_t>(0 == mode ? std::rand() : 1 == mode ? std::rand() % 4 : i / 13 % 7 + (0 == std::rand() % 50));
+        }
+        std::vector<uint8_t> block(size + size / 255 + 16), out(size + 1);
+
+        int blockSize = lz.Compress(payload.data(), size, block.data(), block.size());
+        CHECK(blockSize > 0);
+        CHECK(size == Lz::Decompress(block.data(), blockSize, out.data(), size));
+        CHECK(0 == std::memcmp(out.data(), payload.data(), size));
+
+        /* a smaller capacity cuts the message off */
+        if (size > 0) {
+            int part = std::rand() % size;
+            CHECK(part == DecompressGuarded(block.data(), blockSize, part));
+        }
+        /* flipped bits and truncated blocks never write past the capacity */
+        for (int k = 0; k < 5; ++k) {
+            std::vector<uint8_t> damaged(block.begin(), block.begin() + blockSize);
+            damaged[std::rand() % blockSize] ^= static_cast<uint8_t>(1 << (std::rand() % 8));
+            DecompressGuarded(damaged.data(), std::rand() % (blockSize + 1), size);
+        }
+        /* random data does not fit into half its size */
+        if (size > 20 && 0 == mode) {
+            CHECK(0 == lz.Compress(payload.data(), size, block.data(), size / 2));
+        }
+    }
+
+    /* literals running past the block */
+    const uint8_t literalsPastEnd[] = {0x50, 'a', 'b'};
+    CHECK(-1 == DecompressGuarded(literalsPastEnd, sizeof(literalsPastEnd), 100));
+    /* a match with offset 0 and one reaching before the start of the output */
+    const uint8_t offsetZero[] = {0x10, 'a', 0x00, 0x00, 0x10, 'b'};
+    CHECK(-1 == DecompressGuarded(offsetZero, sizeof(offsetZero), 100));
+    const uint8_t offsetTooFar[] = {0x10, 'a', 0x02, 0x00, 0x10, 'b'};
+    CHECK(-1 == DecompressGuarded(offsetTooFar, sizeof(offsetTooFar), 100));
+    /* a length extension missing its bytes */
+    const uint8_t lengthCut[] = {0xF0, 0xFF};
+    CHECK(-1 == DecompressGuarded(lengthCut, sizeof(lengthCut), 100));
+}
+
+using Manager2 = CanLinkManager<uint8_t, uint8_t>;
+using Manager1 = CanLinkManager<uint8_t>;
+
+/* Delivers and polls both managers for steps rounds of 10 us */
+static void Pump(Manager2& a, Manager1& b, int steps = 5000) {
+    for (int i = 0; i < steps; ++i) {
+        Deliver();
+        a.Poll();
+        b.Poll();
+        g_nowUs += 10;
+    }
+}
+
+/* The payloads of the frame counts in README.md */
+static std::string LogText() {
+    std::string log;
+
+    for (int i = 0; log.size() < 3000; ++i) {
+        log += "[" + std::to_string(1000 + i * 7) + "] ecu: sensor " + std::to_string(i % 5) +
+               " value=" + std::to_string((i * 37) % 100) + " ok\n";
+    }
+    log.resize(3000);
+    return log;
+}
+
+static std::vector<uint8_t> CalibrationTable() {
+    std::vector<uint8_t> table(2048);
+
+    for (int i = 0; i < 1024; ++i) {
+        int16_t value = static_cast<int16_t>(i % 32 < 8 ? 0 : i % 32 < 24 ? 100 * (i / 128) : 800);
+        std::memcpy(&table[i * 2], &value, sizeof(value));
+    }
+    return table;
+}
+
+static void TestManager() {
+    static uint8_t aSend[2][4095], aReceive[2][4095], bSend[4095], bReceive[4095], aScratch[4095], bScratch[4095];
+    static Lz aCodec, bCodec;
+    Manager2 a(uint8_t(1), uint8_t(2), uint8_t(3));
+    Manager1 b(uint8_t(2), uint8_t(1));
+    uint8_t out[4095];
+    uint16_t outSize;
+
+    ResetBus();
+    for (int i = 0; i < 2; ++i) {
+        isotp_config_sendbuf(&a.GetIsotpLinks()[i], aSend[i], sizeof(aSend[i]));
+        isotp_config_rcvbuf(&a.GetIsotpLinks()[i], aReceive[i], sizeof(aReceive[i]));
+    }
+    isotp_config_sendbuf(&b.GetIsotpLinks()[0], bSend, sizeof(bSend));
+    isotp_config_rcvbuf(&b.GetIsotpLinks()[0], bReceive, sizeof(bReceive));
+    IsoTpLink* aLink = a.GetLinkFromPeerAddr(2);
+    IsoTpLink* bLink = b.GetLinkFromPeerAddr(1);
+    aLink->user_send_can_arg = bLink;
+    bLink->user_send_can_arg = aLink;
+
+    std::string log = LogText();
+    std::vector<uint8_t> table = CalibrationTable();
+    std::vector<uint8_t> random(1000);
+    std::srand(1);
+    for (auto& byte : random) {
+        byte = static_cast<uint8_t>(std::rand());
+    }
+
+    /* raw before the codec is set and while only one side runs the extension */
+    CHECK(!a.EnableCompression(2, 64));
+    CHECK(1 == a.Send(2, reinterpret_cast<const uint8_t*>(log.data()), 1000));
+    Pump(a, b);
+    CHECK(ISOTP_RET_OK == b.Receive(1, out, sizeof(out), &outSize) && 1000 == outSize);
+    a.SetCompressionCodec(aCodec, aScratch, sizeof(aScratch));
+    CHECK(a.EnableCompression(2, 64));
+    Pump(a, b);
+    CHECK(ISOTP_RET_OK == b.Receive(1, out, sizeof(out), &outSize) && 5 == outSize && 'P' == out[3]);
+    CHECK(!a.IsCompressionActive(2));
+
+    /* a peer that didn't accept gets messages looking like the extension's as they are */
+    const uint8_t compressed[] = {0xEC, 0x5A, 0x7C, 'Z', 0x00, 0x10, 0x40, 1, 2, 3, 4};
+    const uint8_t escaped[] = {0xEC, 0x5A, 0x7C, 'E', 9, 9};
+    const uint8_t longProbe[] = {0xEC, 0x5A, 0x7C, 'P', 1, 0};
+    const uint8_t badVersion[] = {0xEC, 0x5A, 0x7C, 'A', 7};
+    for (auto message : {std::make_pair(compressed, sizeof(compressed)), std::make_pair(escaped, sizeof(escaped)),
+                         std::make_pair(longProbe, sizeof(longProbe)), std::make_pair(badVersion, sizeof(badVersion))}) {
+        CHECK(1 == isotp_send(bLink, message.first, static_cast<uint16_t>(message.second)));
+        Pump(a, b);
+        CHECK(ISOTP_RET_OK == a.Receive(2, out, sizeof(out), &outSize));
+        CHECK(message.second == outSize && 0 == std::memcmp(out, message.first, outSize));
+        CHECK(!a.IsCompressionActive(2));
+    }
+
+    /* both sides opted in, the handshake leaves nothing to read */
+    b.SetCompressionCodec(bCodec, bScratch, sizeof(bScratch));
+    CHECK(b.EnableCompression(1, 64));
+    Pump(a, b);
+    CHECK(a.IsCompressionActive(2) && b.IsCompressionActive(1));
+    CHECK(ISOTP_RET_NO_DATA == a.Receive(2, out, sizeof(out), &outSize));
+    CHECK(ISOTP_RET_NO_DATA == b.Receive(1, out, sizeof(out), &outSize));
+
+    /* frames on the bus, flow control included, compressed and raw */
+    struct Case {
+        const char* name;
+        const uint8_t* payload;
+        uint16_t size;
+        long compressedFrames;
+        long rawFrames;
+    };
+    const uint8_t magic[20] = {0xEC, 0x5A, 0x7C, 'Z', 0, 5};
+    const Case cases[] = {
+        {"log text", reinterpret_cast<const uint8_t*>(log.data()), 3000, 188, 572},
+        {"cal table", table.data(), 2048, 36, 391},
+        {"random", random.data(), 1000, 191, 191},
+        {"small", reinterpret_cast<const uint8_t*>(log.data()), 40, -1, -1},
+        {"magic", magic, sizeof(magic), -1, -1},
+    };
+    for (const Case& c : cases) {
+        long before = g_framesSent;
+        CHECK(1 == a.Send(2, c.payload, c.size));
+        Pump(a, b);
+        long compressedFrames = g_framesSent - before;
+        CHECK(ISOTP_RET_OK == b.Receive(1, out, sizeof(out), &outSize));
+        CHECK(c.size == outSize && 0 == std::memcmp(out, c.payload, outSize));
+
+        /* sent raw, a message starting with the magic would be taken for the extension's */
+        long rawFrames = 0;
+        if (magic != c.payload) {
+            before = g_framesSent;
+            CHECK(1 == isotp_send(aLink, c.payload, c.size));
+            Pump(a, b);
+            rawFrames = g_framesSent - before;
+            CHECK(ISOTP_RET_OK == b.Receive(1, out, sizeof(out), &outSize));
+            CHECK(c.size == outSize && 0 == std::memcmp(out, c.payload, outSize));
+        }
+
+        CHECK(-1 == c.compressedFrames || c.compressedFrames == compressedFrames);
+        CHECK(-1 == c.rawFrames || c.rawFrames == rawFrames);
+        std::printf("%-9s %4u bytes: %3ld frames, %3ld raw\n", c.name, static_cast<unsigned>(c.size), compressedFrames, rawFrames);
+    }
+
+    /* a short receive buffer gets the start of the message */
+    CHECK(1 == a.Send(2, table.data(), static_cast<uint16_t>(table.size())));
+    Pump(a, b);
+    CHECK(ISOTP_RET_OK == b.Receive(1, out, 100, &outSize) && 100 == outSize);
+    CHECK(0 == std::memcmp(out, table.data(), 100));
+}
+
+/* a message starting with the magic, sent right after the probe, reaches a peer
+ * that accepts the probe before it sees the message
+ */
+static void TestHandshakeEscape() {
+    static uint8_t aSend[2][4095], aReceive[2][4095], bSend[4095], bReceive[4095], aScratch[4095], bScratch[4095];
+    static Lz aCodec, bCodec;
+    Manager2 a(uint8_t(1), uint8_t(2), uint8_t(3));
+    Manager1 b(uint8_t(2), uint8_t(1));
+    const uint8_t magic[20] = {0xEC, 0x5A, 0x7C, 'Z', 0, 5, 1, 2, 3};
+    uint8_t out[4095];
+    uint16_t outSize;
+
+    ResetBus();
+    for (int i = 0; i < 2; ++i) {
+        isotp_config_sendbuf(&a.GetIsotpLinks()[i], aSend[i], sizeof(aSend[i]));
+        isotp_config_rcvbuf(&a.GetIsotpLinks()[i], aReceive[i], sizeof(aReceive[i]));
+    }
+    isotp_config_sendbuf(&b.GetIsotpLinks()[0], bSend, sizeof(bSend));
+    isotp_config_rcvbuf(&b.GetIsotpLinks()[0], bReceive, sizeof(bReceive));
+    a.GetLinkFromPeerAddr(2)->user_send_can_arg = b.GetLinkFromPeerAddr(1);
+    b.GetLinkFromPeerAddr(1)->user_send_can_arg = a.GetLinkFromPeerAddr(2);
+    a.SetCompressionCodec(aCodec, aScratch, sizeof(aScratch));
+    b.SetCompressionCodec(bCodec, bScratch, sizeof(bScratch));
+
+    /* a only sees b's probe as a message, then opts in and sends before b's ack arrives */
+    CHECK(b.EnableCompression(1, 64));
+    Pump(a, b);
+    CHECK(ISOTP_RET_OK == a.Receive(2, out, sizeof(out), &outSize) && 5 == outSize && 'P' == out[3]);
+    CHECK(a.EnableCompression(2, 64));
+    CHECK(!a.IsCompressionActive(2));
+    CHECK(1 == a.Send(2, magic, sizeof(magic)));
+    Pump(a, b);
+    CHECK(ISOTP_RET_OK == b.Receive(1, out, sizeof(out), &outSize));
+    CHECK(sizeof(magic) == outSize && 0 == std::memcmp(out, magic, outSize));
+    CHECK(a.IsCompressionActive(2) && b.IsCompressionActive(1));
+}
+
+int main() {
+    TestCodec();
+    TestManager();
+    TestHandshakeEscape();
+    return Report("test_lz");
+}
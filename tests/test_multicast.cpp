@@ -0,0 +1,99 @@
+#include <cstdlib>
+#include <cstring>
+#include "test_bus.hpp"
+#include "can_link_manager.hpp"
+
+using namespace isotp_test;
+
+static constexpr int k_peers = 3;
+
+static IsoTpLink g_peers[k_peers];
+static long g_framesTo[k_peers];
+
+/* Delivers and polls until no link sends from frames any more */
+template <typename Manager>
+static void RunMulticast(Manager& manager, const IsoTpCanFrame* frames) {
+    for (int step = 0; step < 100000 && 0 != manager.LinksSending(frames); ++step) {
+        manager.Poll();
+        while (!g_bus.empty()) {
+            Frame frame = g_bus.front();
+            g_bus.pop_front();
+            for (int i = 0; i < k_peers; ++i) {
+                if (frame.dst == &g_peers[i]) {
+                    CHECK(frame.id == g_peers[i].receive_arbitration_id);
+                    ++g_framesTo[i];
+                }
+            }
+            isotp_on_can_message(frame.dst, frame.data, frame.len);
+        }
+        for (auto& peer : g_peers) {
+            isotp_poll(&peer);
+        }
+        g_nowUs += 10;
+    }
+}
+
+int main() {
+    /* the manager's send buffers are not used by Multicast */
+    static uint8_t sendBuf[k_peers][8], receiveBuf[k_peers][4095];
+    static uint8_t peerSendBuf[k_peers][4095], peerReceiveBuf[k_peers][4095];
+    static uint8_t payload[2000];
+    static IsoTpCanFrame frames[ISOTP_ENCODED_FRAME_COUNT(sizeof(payload))];
+    CanLinkManager manager(uint8_t(1), uint8_t(2), uint8_t(3), uint8_t(4));
+    uint8_t out[4095];
+    uint16_t outSize;
+
+    for (int i = 0; i < k_peers; ++i) {
+        IsoTpLink& link = manager.GetIsotpLinks()[i];
+        isotp_config_sendbuf(&link, sendBuf[i], sizeof(sendBuf[i]));
+        isotp_config_rcvbuf(&link, receiveBuf[i], sizeof(receiveBuf[i]));
+        isotp_init_link(&g_peers[i], link.receive_arbitration_id, link.send_arbitration_id);
+        isotp_config_sendbuf(&g_peers[i], peerSendBuf[i], sizeof(peerSendBuf[i]));
+        isotp_config_rcvbuf(&g_peers[i], peerReceiveBuf[i], sizeof(peerReceiveBuf[i]));
+        link.user_send_can_arg = &g_peers[i];
+        g_peers[i].user_send_can_arg = &link;
+    }
+    std::srand(1);
+    for (auto& byte : payload) {
+        byte = static_cast<uint8_t>(std::rand());
+    }
+
+    /* all links, each frame goes out with the CAN ID of its link */
+    CHECK(3 == manager.Multicast(payload, sizeof(payload), frames, ISOTP_ENCODED_FRAME_COUNT(sizeof(payload))));
+    CHECK(3 == manager.LinksSending(frames));
+    RunMulticast(manager, frames);
+    for (int i = 0; i < k_peers; ++i) {
+        CHECK(ISOTP_RET_OK == isotp_receive(&g_peers[i], out, sizeof(out), &outSize));
+        CHECK(sizeof(payload) == outSize && 0 == std::memcmp(out, payload, outSize));
+        CHECK(ISOTP_ENCODED_FRAME_COUNT(sizeof(payload)) == g_framesTo[i]);
+    }
+    std::printf("%d frames encoded once, %ld sent to %d peers\n", static_cast<int>(ISOTP_ENCODED_FRAME_COUNT(sizeof(payload))),
+                g_framesTo[0] + g_framesTo[1] + g_framesTo[2], k_peers);
+
+    /* frames too small, busy links and unknown peers are skipped */
+    static const uint8_t first[] = {2};
+    static const uint8_t peerAddrs[] = {2, 4, 9};
+    IsoTpCanFrame few[2];
+    CHECK(1 == manager.Multicast(payload, sizeof(payload), frames, ISOTP_ENCODED_FRAME_COUNT(sizeof(payload)), first, 1));
+    CHECK(0 == manager.Multicast(payload, 10, few, 1, peerAddrs, 3));
+    CHECK(1 == manager.Multicast(payload, 10, few, 2, peerAddrs, 3));
+    RunMulticast(manager, frames);
+    RunMulticast(manager, few);
+    CHECK(ISOTP_RET_OK == isotp_receive(&g_peers[0], out, sizeof(out), &outSize) && sizeof(payload) == outSize);
+    CHECK(ISOTP_RET_OK != isotp_receive(&g_peers[1], out, sizeof(out), &outSize));
+    CHECK(ISOTP_RET_OK == isotp_receive(&g_peers[2], out, sizeof(out), &outSize) && 10 == outSize);
+
+    /* without a peer list the count is limited to the links */
+    CHECK(2 == manager.Multicast(payload, 10, few, 2, nullptr, 2));
+    RunMulticast(manager, few);
+    CHECK(ISOTP_RET_OK == isotp_receive(&g_peers[0], out, sizeof(out), &outSize) && 10 == outSize);
+    CHECK(ISOTP_RET_OK == isotp_receive(&g_peers[1], out, sizeof(out), &outSize) && 10 == outSize);
+    CHECK(ISOTP_RET_OK != isotp_receive(&g_peers[2], out, sizeof(out), &outSize));
+    CHECK(3 == manager.Multicast(payload, 10, few, 2, nullptr, 100));
+    RunMulticast(manager, few);
+    for (int i = 0; i < k_peers; ++i) {
+        CHECK(ISOTP_RET_OK == isotp_receive(&g_peers[i], out, sizeof(out), &outSize) && 10 == outSize);
+    }
+
+    return Report("test_multicast");
+}
@@ -0,0 +1,82 @@
+#include "test_bus.hpp"
+
+using namespace isotp_test;
+
+static uint8_t aSend[4095], aReceive[4095], bSend[4095], bReceive[4095];
+static IsoTpLink a, b;
+static uint8_t g_message[100];
+
+static constexpr uint32_t k_timeoutUs = ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+
+/* flow control from b to a with the given block size and STmin byte */
+static void FlowControl(uint8_t blockSize, uint8_t stMin) {
+    const uint8_t frame[] = {0x30, blockSize, stMin};
+
+    isotp_on_can_message(&a, frame, sizeof(frame));
+}
+
+int main() {
+    ConnectLinks(&a, &b, aSend, aReceive, bSend, bReceive, sizeof(aSend));
+    ResetBus();
+
+    /* nothing pending */
+    CHECK(ISOTP_NO_DEADLINE == isotp_poll_us(&a) && ISOTP_NO_DEADLINE == isotp_poll_us(&b));
+
+    /* after the first frame, the sender waits for flow control until N_Bs */
+    CHECK(1 == isotp_send(&a, g_message, sizeof(g_message)));
+    CHECK(k_timeoutUs + 1 == isotp_poll_us(&a));
+    g_nowUs += 30000;
+    CHECK(k_timeoutUs - 30000 + 1 == isotp_poll_us(&a));
+
+    /* the receiver waits for the next consecutive frame until N_Cr */
+    Deliver();
+    CHECK(k_timeoutUs + 1 == isotp_poll_us(&b));
+    g_nowUs += 40000;
+    CHECK(k_timeoutUs - 40000 + 1 == isotp_poll_us(&b));
+    g_bus.clear();
+
+    /* STmin of 5 ms: each consecutive frame goes out when the poll comes back */
+    FlowControl(0, 5);
+    CHECK(5000 + 1 == isotp_poll_us(&a) && 1 == g_bus.size());
+    g_nowUs += 2000;
+    CHECK(3000 + 1 == isotp_poll_us(&a) && 1 == g_bus.size());
+    g_nowUs += 3001;
+    CHECK(5000 + 1 == isotp_poll_us(&a) && 2 == g_bus.size());
+
+    /* STmin counts from the first frame, then an STmin of 127 ms is longer than N_Bs, which comes first */
+    isotp_init_link(&a, 0x100, 0x200);
+    isotp_config_sendbuf(&a, aSend, sizeof(aSend));
+    isotp_config_rcvbuf(&a, aReceive, sizeof(aReceive));
+    a.user_send_can_arg = &b;
+    g_bus.clear();
+    CHECK(1 == isotp_send(&a, g_message, sizeof(g_message)));
+    FlowControl(0, 0x7F);
+    CHECK(1 == isotp_poll_us(&a) && 1 == g_bus.size());
+    g_nowUs += 1;
+    CHECK(k_timeoutUs + 1 == isotp_poll_us(&a) && 2 == g_bus.size());
+
+    /* block of one: after its frame, the sender waits for flow control again */
+    isotp_init_link(&a, 0x100, 0x200);
+    isotp_config_sendbuf(&a, aSend, sizeof(aSend));
+    isotp_config_rcvbuf(&a, aReceive, sizeof(aReceive));
+    a.user_send_can_arg = &b;
+    g_bus.clear();
+    CHECK(1 == isotp_send(&a, g_message, sizeof(g_message)));
+    FlowControl(1, 0);
+    CHECK(k_timeoutUs + 1 == isotp_poll_us(&a) && 2 == g_bus.size());
+    g_nowUs += k_timeoutUs;
+    CHECK(1 == isotp_poll_us(&a));
+
+    /* a frame refused by the driver is retried after ISO_TP_NOSPACE_RETRY_US */
+    g_nowUs += 1;
+    CHECK(0 == isotp_poll_us(&a) && ISOTP_SEND_STATUS_ERROR == a.send_status);
+    CHECK(ISOTP_NO_DEADLINE == isotp_poll_us(&a));
+    g_bus.clear();
+    g_refuseSends = 2;
+    CHECK(1 == isotp_send(&a, g_message, 5));
+    CHECK(ISO_TP_NOSPACE_RETRY_US == isotp_poll_us(&a) && g_bus.empty());
+    g_nowUs += ISO_TP_NOSPACE_RETRY_US;
+    CHECK(ISOTP_NO_DEADLINE == isotp_poll_us(&a) && 1 == g_bus.size());
+
+    return Report("test_poll_us");
+}
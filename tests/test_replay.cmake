@@ -0,0 +1,29 @@
+# Replays tools/sample_trace.log and compares what isotp_replay prints, the
+# reassembled PDUs and the protocol errors at their virtual times, to the
+# expected output. Run by ctest with -DREPLAY=<tool> -DTRACE=<trace>.
+execute_process(COMMAND ${REPLAY} --print --verbose ${TRACE} OUTPUT_VARIABLE output RESULT_VARIABLE result)
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "isotp_replay exited with ${result}")
+endif()
+
+# the wall time depends on the machine
+string(REGEX REPLACE "wall time:[^\n]*\n" "" output "${output}")
+
+# the stalled transfer times out N_Cr after its last consecutive frame at 0.101000
+set(expected [=[
+  0.000000  01 -> 02  [   2]  10 03
+  0.001000  02 -> 01  [   6]  50 03 00 32 01 F4
+  0.011500  02 -> 01  [  20]  62 F1 90 41 42 43 44 45 46 47 48 49 50 51 52 53 54 55 56 57
+  0.201001  01 -> 02  timeout Cr
+  0.500000  02 -> 01  [   2]  7E 00
+trace:     10 lines, 0 skipped, 0.500000 s
+frames:    10 (9 ISO-TP, 1 other), 2 flow control generated
+messages:  4 reassembled, 30 bytes, 0 incomplete at end of trace
+errors:    1
+  timeout Cr       1
+]=])
+string(REGEX REPLACE "^\n" "" expected "${expected}")
+
+if (NOT output STREQUAL expected)
+    message(FATAL_ERROR "unexpected replay output:\n${output}\nexpected:\n${expected}")
+endif()
@@ -0,0 +1,76 @@
+#include <cstring>
+#include "test_bus.hpp"
+#include "can_link_manager.hpp"
+
+using namespace isotp_test;
+
+static constexpr int k_peers = 3;
+
+static IsoTpLink g_peers[k_peers];
+
+int main() {
+    static uint8_t sendBuf[k_peers][4095], receiveBuf[k_peers][4095];
+    static uint8_t peerSendBuf[k_peers][4095], peerReceiveBuf[k_peers][4095];
+    static uint8_t message[1000];
+    CanLinkManager manager(uint8_t(1), uint8_t(2), uint8_t(3), uint8_t(4));
+    uint8_t out[4095];
+    uint16_t outSize;
+
+    for (int i = 0; i < k_peers; ++i) {
+        IsoTpLink& link = manager.GetIsotpLinks()[i];
+        isotp_config_sendbuf(&link, sendBuf[i], sizeof(sendBuf[i]));
+        isotp_config_rcvbuf(&link, receiveBuf[i], sizeof(receiveBuf[i]));
+        isotp_init_link(&g_peers[i], link.receive_arbitration_id, link.send_arbitration_id);
+        isotp_config_sendbuf(&g_peers[i], peerSendBuf[i], sizeof(peerSendBuf[i]));
+        isotp_config_rcvbuf(&g_peers[i], peerReceiveBuf[i], sizeof(peerReceiveBuf[i]));
+        link.user_send_can_arg = &g_peers[i];
+        g_peers[i].user_send_can_arg = &link;
+        CHECK(manager.GetLinkFromReceiveCanId(static_cast<uint16_t>(link.receive_arbitration_id)) == &link);
+    }
+
+    /* functional addressing, frames to other nodes, non-ISOTP frames and unknown senders have no link */
+    CHECK(nullptr == manager.GetLinkFromReceiveCanId(0x400 | (2 << 5) | 5));
+    CHECK(nullptr == manager.GetLinkFromReceiveCanId((2 << 5) | 1));
+    CHECK(nullptr == manager.GetLinkFromReceiveCanId(0x400 | (9 << 5) | 1));
+    CHECK(nullptr == manager.GetLinkFromReceiveCanId(0xC00 | (2 << 5) | 1));
+    {
+        uint8_t data[8] = {0};
+        CHECK(ISOTP_RET_ERROR == manager.OnCanMessageIsr(0x123, data, sizeof(data)));
+    }
+
+    /* frames found through the lookup, interleaved with frames of other nodes */
+    for (std::size_t i = 0; i < sizeof(message); ++i) {
+        message[i] = static_cast<uint8_t>(i * 7);
+    }
+    ResetBus();
+    for (auto& peer : g_peers) {
+        CHECK(1 == isotp_send(&peer, message, sizeof(message)));
+    }
+    for (int step = 0; step < 20000; ++step) {
+        while (!g_bus.empty()) {
+            Frame frame = g_bus.front();
+            g_bus.pop_front();
+            if (frame.dst >= g_peers && frame.dst < g_peers + k_peers) {
+                isotp_on_can_message(frame.dst, frame.data, frame.len);
+                continue;
+            }
+            CHECK(nullptr == manager.GetLinkFromReceiveCanId(0x123));
+            IsoTpLink* link = manager.GetLinkFromReceiveCanId(static_cast<uint16_t>(frame.id));
+            CHECK(link == frame.dst);
+            if (nullptr != link) {
+                isotp_on_can_message(link, frame.data, frame.len);
+            }
+        }
+        manager.Poll();
+        for (auto& peer : g_peers) {
+            isotp_poll(&peer);
+        }
+        g_nowUs += 10;
+    }
+    for (auto& link : manager.GetIsotpLinks()) {
+        CHECK(ISOTP_RET_OK == isotp_receive(&link, out, sizeof(out), &outSize));
+        CHECK(sizeof(message) == outSize && 0 == std::memcmp(out, message, outSize));
+    }
+
+    return Report("test_rx_lookup");
+}
@@ -0,0 +1,136 @@
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include "test_bus.hpp"
+
+using namespace isotp_test;
+
+/* Like Deliver, but frames to isr go through isotp_on_can_message_isr */
+static void DeliverToRing(IsoTpLink* isr) {
+    while (!g_bus.empty()) {
+        Frame frame = g_bus.front();
+        g_bus.pop_front();
+        if (frame.dst == isr) {
+            CHECK(ISOTP_RET_OK == isotp_on_can_message_isr(isr, frame.data, frame.len));
+        } else {
+            isotp_on_can_message(frame.dst, frame.data, frame.len);
+        }
+    }
+}
+
+static void TestMessage() {
+    static uint8_t aSend[4095], aReceive[4095], bSend[4095], bReceive[4095];
+    static IsoTpCanFrame ring[20];
+    IsoTpLink a, b;
+    uint8_t message[4000], out[4095];
+    uint16_t outSize;
+
+    ResetBus();
+    ConnectLinks(&a, &b, aSend, aReceive, bSend, bReceive, sizeof(aSend));
+    isotp_config_rx_ring(&b, ring, 20);
+    CHECK(15 == b.rx_ring_mask);
+    for (std::size_t i = 0; i < sizeof(message); ++i) {
+        message[i] = static_cast<uint8_t>(i * 3);
+    }
+
+    /* the whole message, flow control frames included, goes through the ring */
+    CHECK(1 == isotp_send(&a, message, sizeof(message)));
+    for (int step = 0; step < 100000; ++step) {
+        DeliverToRing(&b);
+        isotp_poll(&a);
+        isotp_poll(&b);
+        CHECK(b.rx_ring_head == b.rx_ring_tail);
+        g_nowUs += 10;
+        if (ISOTP_SEND_STATUS_IDLE == a.send_status && ISOTP_RECEIVE_STATUS_FULL == b.receive_status) {
+            break;
+        }
+    }
+    CHECK(ISOTP_RET_OK == isotp_receive(&b, out, sizeof(out), &outSize));
+    CHECK(sizeof(message) == outSize && 0 == std::memcmp(out, message, outSize));
+    CHECK(b.rx_ring_high_water >= 1 && b.rx_ring_high_water <= 16 && 0 == b.rx_ring_dropped);
+    std::printf("ring high water %u, dropped %u\n", static_cast<unsigned>(b.rx_ring_high_water),
+                static_cast<unsigned>(b.rx_ring_dropped));
+
+    /* a full ring drops the frame and counts it */
+    uint8_t data[8] = {0};
+    for (int i = 0; i < 16; ++i) {
+        CHECK(ISOTP_RET_OK == isotp_on_can_message_isr(&b, data, sizeof(data)));
+    }
+    CHECK(ISOTP_RET_OVERFLOW == isotp_on_can_message_isr(&b, data, sizeof(data)));
+    CHECK(1 == b.rx_ring_dropped && 16 == b.rx_ring_high_water);
+    isotp_process_rx(&b);
+    CHECK(b.rx_ring_head == b.rx_ring_tail);
+    CHECK(ISOTP_RET_OK == isotp_on_can_message_isr(&b, data, sizeof(data)));
+    isotp_process_rx(&b);
+
+    /* lengths isotp_on_can_message would ignore are refused and not queued */
+    uint8_t longData[64] = {0};
+    uint16_t head = b.rx_ring_head;
+    CHECK(ISOTP_RET_LENGTH == isotp_on_can_message_isr(&b, longData, 9));
+    CHECK(ISOTP_RET_LENGTH == isotp_on_can_message_isr(&b, longData, sizeof(longData)));
+    CHECK(ISOTP_RET_LENGTH == isotp_on_can_message_isr(&b, data, 1));
+    CHECK(head == b.rx_ring_head && 1 == b.rx_ring_dropped);
+
+#if defined(ISO_TP_ISR_CYCLE_COUNTER)
+    CHECK(b.rx_isr_max_cycles > 0);
+    std::printf("isotp_on_can_message_isr worst case %u cycles\n", static_cast<unsigned>(b.rx_isr_max_cycles));
+#endif
+
+    /* without a ring the interrupt side refuses the frame */
+    CHECK(ISOTP_RET_ERROR == isotp_on_can_message_isr(&a, data, sizeof(data)));
+    CHECK(0 == isotp_process_rx(&a));
+    ResetBus();
+}
+
+/* A thread stands in for the interrupt. The main thread takes the frames out
+ * of the ring the way isotp_process_rx does and checks their order and content.
+ */
+static void TestConcurrentProducer() {
+    static constexpr uint32_t k_frames = 200000;
+    static IsoTpCanFrame ring[8];
+    IsoTpLink link;
+    std::atomic<bool> producing{true};
+    uint32_t expected = 0;
+
+    isotp_init_link(&link, 0x100, 0x200);
+    isotp_config_rx_ring(&link, ring, 8);
+
+    std::thread producer([&link, &producing] {
+        for (uint32_t i = 0; i < k_frames;) {
+            uint8_t data[8];
+            std::memcpy(data, &i, 4);
+            std::memcpy(data + 4, &i, 4);
+            if (ISOTP_RET_OK == isotp_on_can_message_isr(&link, data, sizeof(data))) {
+                ++i;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        producing = false;
+    });
+    while (producing || link.rx_ring_tail != link.rx_ring_head) {
+        uint16_t tail = link.rx_ring_tail;
+
+        while (tail != link.rx_ring_head) {
+            const IsoTpCanFrame& frame = ring[tail & link.rx_ring_mask];
+            uint32_t first, second;
+
+            ISOTP_MEMORY_BARRIER();
+            std::memcpy(&first, frame.data, 4);
+            std::memcpy(&second, frame.data + 4, 4);
+            CHECK(expected == first && expected == second && 8 == frame.len);
+            ++expected;
+            ISOTP_MEMORY_BARRIER();
+            link.rx_ring_tail = ++tail;
+        }
+        std::this_thread::yield();
+    }
+    producer.join();
+    CHECK(k_frames == expected);
+}
+
+int main() {
+    TestMessage();
+    TestConcurrentProducer();
+    return Report("test_rx_ring");
+}
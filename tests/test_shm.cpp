@@ -0,0 +1,348 @@
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <signal.h>
+#include <sys/wait.h>
+#include "test_bus.hpp"
+#include "can_link_manager.hpp"
+#include "isotp_shm.hpp"
+
+using namespace isotp_test;
+
+/* Daemon with address 1 and the peers 2 and 3 on the loopback bus. The client
+ * runs in a forked process and reports through its exit code.
+ */
+using Manager = CanLinkManager<uint8_t, uint8_t>;
+using Daemon = IsoTpShmDaemon<Manager>;
+
+static std::string g_path;
+static IsoTpLink g_peers[2];
+static std::deque<std::vector<uint8_t>> g_replies[2];
+
+/* the peers answer every message with its bytes xor 0x5A */
+static void OnPeerEvent(IsoTpLink* link, IsoTpEventTypes event, int, void*) {
+    static uint8_t message[4095];
+    uint16_t size;
+
+    if (ISOTP_EVENT_RECEIVE_COMPLETE != event || ISOTP_RET_OK != isotp_receive(link, message, sizeof(message), &size)) {
+        return;
+    }
+    for (uint16_t i = 0; i < size; ++i) {
+        message[i] ^= 0x5A;
+    }
+    g_replies[link - g_peers].emplace_back(message, message + size);
+}
+
+static void SetupLinks(Manager& manager, bool withPeers) {
+    static uint8_t sendBuf[2][8], receiveBuf[2][64], peerSendBuf[2][4095], peerReceiveBuf[2][4095];
+
+    ResetBus();
+    for (int i = 0; i < 2; ++i) {
+        IsoTpLink& link = manager.GetIsotpLinks()[i];
+        isotp_config_sendbuf(&link, sendBuf[i], sizeof(sendBuf[i]));
+        isotp_config_rcvbuf(&link, receiveBuf[i], sizeof(receiveBuf[i]));
+        link.user_send_can_arg = nullptr;
+        if (withPeers) {
+            isotp_init_link(&g_peers[i], link.receive_arbitration_id, link.send_arbitration_id);
+            isotp_config_sendbuf(&g_peers[i], peerSendBuf[i], sizeof(peerSendBuf[i]));
+            isotp_config_rcvbuf(&g_peers[i], peerReceiveBuf[i], sizeof(peerReceiveBuf[i]));
+            isotp_config_event_cb(&g_peers[i], OnPeerEvent, nullptr);
+            link.user_send_can_arg = &g_peers[i];
+            g_peers[i].user_send_can_arg = &link;
+        }
+    }
+}
+
+/* One pass of the daemon's main loop.
+ * Return the number of fds polled
+ */
+static std::size_t Step(Daemon& daemon, Manager& manager, int timeoutMs, long* wakes = nullptr) {
+    struct pollfd fds[20];
+    std::size_t count = daemon.GetPollFds(fds, 20);
+
+    (void) poll(fds, count, timeoutMs);
+    for (std::size_t i = 1; nullptr != wakes && i < count; ++i) {
+        *wakes += 0 != fds[i].revents ? 1 : 0;
+    }
+    daemon.Process(fds, count);
+    Deliver();
+    manager.Poll();
+    return count;
+}
+
+static int EchoClient() {
+    static constexpr int k_messages = 300;
+    IsoTpShmClient client;
+    uint8_t pattern[4095];
+    int sent = 0, received = 0;
+
+    if (!client.Connect(g_path.c_str(), (1u << 2) | (1u << 3))) {
+        return 1;
+    }
+    if (((1u << 2) | (1u << 3)) != client.GrantedPeers()) {
+        return 2;
+    }
+    for (int i = 0; i < 4095; ++i) {
+        pattern[i] = static_cast<uint8_t>(i * 13);
+    }
+    while (received < k_messages) {
+        while (sent < k_messages) {
+            uint16_t size = static_cast<uint16_t>(1 + (sent * 997) % 4095);
+            uint8_t* payload = client.BeginSend(size);
+            if (nullptr == payload) {
+                break;
+            }
+            std::memcpy(payload, pattern, size);
+            client.CommitSend(static_cast<uint8_t>(2 + sent % 2), size);
+            ++sent;
+        }
+
+        const uint8_t* message;
+        uint8_t peer;
+        uint16_t size;
+        /* the replies of the two peers interleave, only the content is checked */
+        while (nullptr != (message = client.Receive(peer, size))) {
+            for (uint16_t i = 0; i < size; ++i) {
+                if ((message[i] ^ 0x5A) != pattern[i]) {
+                    return 3;
+                }
+            }
+            ++received;
+            client.Release(size);
+        }
+        client.Wait(100);
+    }
+    return k_messages == static_cast<int>(client.SendsCompleted()) && 0 == client.SendsFailed() ? 0 : 4;
+}
+
+/* messages go from the client to the peers and back through the rings */
+static void TestEcho() {
+    Manager manager(uint8_t(1), uint8_t(2), uint8_t(3));
+    int status = -1;
+
+    SetupLinks(manager, true);
+    Daemon daemon(manager);
+    CHECK(daemon.Listen(g_path.c_str()));
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        _exit(EchoClient());
+    }
+    for (int step = 0; step < 2000000; ++step) {
+        Step(daemon, manager, 0);
+        for (int i = 0; i < 2; ++i) {
+            isotp_poll(&g_peers[i]);
+            if (!g_replies[i].empty() && ISOTP_SEND_STATUS_IDLE == g_peers[i].send_status) {
+                isotp_send(&g_peers[i], g_replies[i].front().data(), static_cast<uint16_t>(g_replies[i].front().size()));
+                g_replies[i].pop_front();
+            }
+        }
+        g_nowUs += 10;
+        if (pid == waitpid(pid, &status, WNOHANG)) {
+            break;
+        }
+    }
+    CHECK(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+    std::printf("echo: client exit %d, %ld frames on the bus\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1, g_framesSent);
+
+    /* the daemon notices the client going away */
+    for (int i = 0; i < 10; ++i) {
+        Step(daemon, manager, 1);
+    }
+    CHECK(1 == Step(daemon, manager, 0));
+}
+
+/* a client that connected but never sends its peer mask doesn't stall the daemon */
+static void TestSilentClient() {
+    Manager manager(uint8_t(1), uint8_t(2), uint8_t(3));
+    struct sockaddr_un addr = {};
+
+    SetupLinks(manager, false);
+    Daemon daemon(manager);
+    CHECK(daemon.Listen(g_path.c_str()));
+
+    int silent = socket(AF_UNIX, SOCK_STREAM, 0);
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, g_path.c_str(), sizeof(addr.sun_path) - 1);
+    CHECK(0 == connect(silent, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)));
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 5; ++i) {
+        Step(daemon, manager, 0);
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    CHECK(ms < 500);
+    CHECK(2 == Step(daemon, manager, 0));
+
+    close(silent);
+    for (int i = 0; i < 10; ++i) {
+        Step(daemon, manager, 1);
+    }
+    CHECK(1 == Step(daemon, manager, 0));
+}
+
+/* A message the peer never answers keeps the link waiting for flow control
+ * without waking the daemon, and a record running past the ring disconnects
+ * the client.
+ */
+static void TestCorruptRecord() {
+    Manager manager(uint8_t(1), uint8_t(2), uint8_t(3));
+    long wakes = 0;
+    int status = -1;
+    std::size_t count = 0;
+
+    SetupLinks(manager, false);
+    Daemon daemon(manager);
+    CHECK(daemon.Listen(g_path.c_str()));
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        IsoTpShmClient client;
+        if (!client.Connect(g_path.c_str(), 1u << 2)) {
+            _exit(1);
+        }
+        uint8_t* payload = client.BeginSend(2000);
+        std::memset(payload, 1, 2000);
+        client.CommitSend(2, 2000);
+        /* the daemon reads the second record only after the first one failed */
+        payload = client.BeginSend(4);
+        client.CommitSend(2, 4);
+        uint16_t badSize = 0xFFF0;
+        std::memcpy(payload - IsoTpShmRing::k_headerSize, &badSize, sizeof(badSize));
+        usleep(1000000);
+        _exit(0);
+    }
+    for (int step = 0; step < 1000; ++step) {
+        count = Step(daemon, manager, 2, &wakes);
+        g_bus.clear();
+        g_nowUs += 1000;
+        if (step > 200 && 1 == count) {
+            break;
+        }
+    }
+    std::printf("corrupt record: %ld wakes, %zu fds polled at the end\n", wakes, count);
+    CHECK(1 == count && wakes < 20);
+    CHECK(ISOTP_SEND_STATUS_INPROGRESS != manager.GetIsotpLinks()[0].send_status);
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+}
+
+/* Connects for peer 2, reports through ready and checks that the first message
+ * received is the full reply to the pattern of size bytes.
+ */
+static int ReceiveClient(int ready, uint16_t size) {
+    IsoTpShmClient client;
+    const uint8_t* message;
+    uint8_t peer;
+    uint16_t received;
+
+    if (!client.Connect(g_path.c_str(), 1u << 2) || (1u << 2) != client.GrantedPeers()) {
+        return 1;
+    }
+    (void) write(ready, "r", 1);
+    while (nullptr == (message = client.Receive(peer, received))) {
+        client.Wait(100);
+    }
+    if (2 != peer || size != received) {
+        return 2;
+    }
+    for (uint16_t i = 0; i < size; ++i) {
+        if (message[i] != static_cast<uint8_t>(i * 7)) {
+            return 3;
+        }
+    }
+    return 0;
+}
+
+/* Steps the daemon without running the peers until the child wrote to ready */
+static void WaitReady(Daemon& daemon, Manager& manager, int ready) {
+    char byte;
+
+    for (int step = 0; step < 10000 && 1 != read(ready, &byte, 1); ++step) {
+        Step(daemon, manager, 1);
+    }
+}
+
+/* A client going away in the middle of a message, with another one taking its
+ * peer before the next consecutive frame arrives.
+ */
+static void TestDisconnectMidMessage() {
+    Manager manager(uint8_t(1), uint8_t(2), uint8_t(3));
+    IsoTpLink& link = manager.GetIsotpLinks()[0];
+    static uint8_t first[3000], second[1000];
+    int ready[2], status = -1;
+
+    SetupLinks(manager, true);
+    Daemon daemon(manager);
+    CHECK(daemon.Listen(g_path.c_str()));
+    CHECK(0 == pipe(ready));
+    fcntl(ready[0], F_SETFL, O_NONBLOCK);
+    for (std::size_t i = 0; i < sizeof(first); ++i) {
+        first[i] = static_cast<uint8_t>(i * 3);
+    }
+    for (std::size_t i = 0; i < sizeof(second); ++i) {
+        second[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    pid_t gone = fork();
+    if (0 == gone) {
+        _exit(ReceiveClient(ready[1], sizeof(first)) + 10);
+    }
+    WaitReady(daemon, manager, ready[0]);
+
+    /* the peer sends until part of the message is in the client's ring */
+    CHECK(1 == isotp_send(&g_peers[0], first, sizeof(first)));
+    for (int step = 0; step < 10000; ++step) {
+        Step(daemon, manager, 0);
+        if (link.receive_offset >= 1000) {
+            break;
+        }
+        isotp_poll(&g_peers[0]);
+        g_nowUs += 10;
+    }
+    CHECK(ISOTP_RECEIVE_STATUS_INPROGRESS == link.receive_status && link.receive_offset >= 1000);
+
+    kill(gone, SIGKILL);
+    waitpid(gone, &status, 0);
+    for (int i = 0; i < 10; ++i) {
+        Step(daemon, manager, 1);
+    }
+    CHECK(ISOTP_RECEIVE_STATUS_IDLE == link.receive_status);
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        _exit(ReceiveClient(ready[1], sizeof(second)));
+    }
+    WaitReady(daemon, manager, ready[0]);
+
+    /* the rest of the first message is dropped, the next one arrives whole */
+    bool sentSecond = false;
+    status = -1;
+    for (int step = 0; step < 2000000; ++step) {
+        Step(daemon, manager, 0);
+        isotp_poll(&g_peers[0]);
+        if (!sentSecond && ISOTP_SEND_STATUS_INPROGRESS != g_peers[0].send_status) {
+            sentSecond = 1 == isotp_send(&g_peers[0], second, sizeof(second));
+        }
+        g_nowUs += 10;
+        if (pid == waitpid(pid, &status, WNOHANG)) {
+            break;
+        }
+    }
+    CHECK(sentSecond && WIFEXITED(status) && 0 == WEXITSTATUS(status));
+    std::printf("disconnect mid message: second client exit %d\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+    close(ready[0]);
+    close(ready[1]);
+}
+
+int main() {
+    std::setvbuf(stdout, nullptr, _IONBF, 0);
+    g_path = "/tmp/isotp_test_shm_" + std::to_string(getpid()) + ".sock";
+    TestSilentClient();
+    TestEcho();
+    TestCorruptRecord();
+    TestDisconnectMidMessage();
+    unlink(g_path.c_str());
+    return Report("test_shm");
+}
@@ -0,0 +1,118 @@
+#include <cstring>
+#include <vector>
+#include "test_bus.hpp"
+
+using namespace isotp_test;
+
+static std::vector<uint8_t> g_received;
+static int g_messages = 0;
+static bool g_consumerBusy = false;
+
+static int OnChunk(IsoTpLink*, const uint8_t* data, uint16_t offset, uint16_t size, uint16_t totalSize, void*) {
+    if (g_consumerBusy) {
+        return ISOTP_RET_NOSPACE;
+    }
+    CHECK(offset == g_received.size());
+    g_received.insert(g_received.end(), data, data + size);
+    if (offset + size == totalSize) {
+        ++g_messages;
+    }
+    return ISOTP_RET_OK;
+}
+
+static uint8_t g_source[3000];
+static int g_sourceCalls = 0;
+
+/* hands out at most 3 bytes per call and is not ready on every 5th call */
+static int SlowSource(IsoTpLink*, uint8_t* data, uint16_t offset, uint16_t size, void*) {
+    if (0 == ++g_sourceCalls % 5) {
+        return 0;
+    }
+    uint16_t count = size > 3 ? 3 : size;
+    std::memcpy(data, g_source + offset, count);
+    return count;
+}
+
+static void TestStreamingReceive() {
+    static uint8_t aSend[4095], aReceive[4095], bSend[4095];
+    static uint8_t stage[7];
+    IsoTpLink a, b;
+    uint8_t out[16];
+    uint16_t outSize;
+
+    for (int i = 0; i < 3000; ++i) {
+        g_source[i] = static_cast<uint8_t>(i * 7);
+    }
+    ConnectLinks(&a, &b, aSend, aReceive, bSend, stage, sizeof(aSend));
+    isotp_config_rcvbuf(&b, stage, sizeof(stage));
+    isotp_config_rcv_stream(&b, OnChunk, nullptr);
+
+    /* far larger than the receive buffer */
+    g_received.clear();
+    CHECK(1 == isotp_send(&a, g_source, 3000));
+    Run({&a, &b});
+    CHECK(1 == g_messages && 3000 == g_received.size() && 0 == std::memcmp(g_received.data(), g_source, 3000));
+
+    g_received.clear();
+    CHECK(1 == isotp_send(&a, g_source, 5));
+    Run({&a, &b});
+    CHECK(2 == g_messages && 5 == g_received.size() && 0 == std::memcmp(g_received.data(), g_source, 5));
+    CHECK(ISOTP_RET_NO_DATA == isotp_receive(&b, out, sizeof(out), &outSize));
+
+    /* a busy consumer holds the sender back, the data arrives once it takes chunks again */
+    g_received.clear();
+    g_consumerBusy = true;
+    CHECK(1 == isotp_send(&a, g_source, 100));
+    Run({&a, &b}, 50, 1000);
+    CHECK(ISOTP_SEND_STATUS_INPROGRESS == a.send_status && g_received.empty());
+    g_consumerBusy = false;
+    Run({&a, &b}, 1000, 1000);
+    CHECK(3 == g_messages && 100 == g_received.size() && 0 == std::memcmp(g_received.data(), g_source, 100));
+    CHECK(ISOTP_PROTOCOL_RESULT_OK == a.send_protocol_result);
+}
+
+static void TestStreamingSend() {
+    static uint8_t aSend[7], aReceive[4095], bSend[4095], bReceive[4095];
+    IsoTpLink a, b;
+    uint8_t out[4095];
+    uint16_t outSize;
+
+    ConnectLinks(&a, &b, aSend, aReceive, bSend, bReceive, sizeof(aReceive));
+    isotp_config_sendbuf(&a, aSend, sizeof(aSend));
+
+    /* the whole message does not fit into the send buffer */
+    CHECK(0 == isotp_send(&a, g_source, 3000));
+    g_sourceCalls = 0;
+    while (0 == isotp_send_stream(&a, 3000, SlowSource, nullptr)) {
+    }
+    Run({&a, &b});
+    CHECK(ISOTP_RET_OK == isotp_receive(&b, out, sizeof(out), &outSize));
+    CHECK(3000 == outSize && 0 == std::memcmp(out, g_source, 3000));
+
+    g_sourceCalls = 0;
+    while (0 == isotp_send_stream(&a, 5, SlowSource, nullptr)) {
+    }
+    Run({&a, &b});
+    CHECK(ISOTP_RET_OK == isotp_receive(&b, out, sizeof(out), &outSize));
+    CHECK(5 == outSize && 0 == std::memcmp(out, g_source, 5));
+
+    /* a consecutive frame refused by the driver keeps its staged data */
+    g_sourceCalls = 0;
+    g_refuseTo = &b;
+    while (0 == isotp_send_stream(&a, 100, SlowSource, nullptr)) {
+    }
+    for (int i = 0; i < 50; ++i) {
+        g_refuseSends = 1;
+        Run({&a, &b}, 3);
+    }
+    Run({&a, &b});
+    ResetBus();
+    CHECK(ISOTP_RET_OK == isotp_receive(&b, out, sizeof(out), &outSize));
+    CHECK(100 == outSize && 0 == std::memcmp(out, g_source, 100));
+}
+
+int main() {
+    TestStreamingReceive();
+    TestStreamingSend();
+    return Report("test_stream");
+}
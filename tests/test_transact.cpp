@@ -0,0 +1,151 @@
+#include <cstring>
+#include <vector>
+#include "test_bus.hpp"
+#include "can_link_manager.hpp"
+
+using namespace isotp_test;
+
+/* The peer answers each request with g_responseSize bytes of a pattern, unless
+ * g_answer is false.
+ */
+static IsoTpLink g_peer;
+static bool g_answer = true;
+static uint16_t g_responseSize;
+static std::vector<uint8_t> g_pattern(4095);
+static bool g_replyDue;
+
+/* what the transaction callback saw */
+struct Outcome {
+    int calls;
+    IsoTpTransactResult result;
+    uint16_t size;
+    uint32_t timeUs;
+};
+
+static void OnPeerEvent(IsoTpLink* link, IsoTpEventTypes event, int, void*) {
+    uint8_t request[4095];
+    uint16_t size;
+
+    if (ISOTP_EVENT_RECEIVE_COMPLETE == event && ISOTP_RET_OK == isotp_receive(link, request, sizeof(request), &size)) {
+        g_replyDue = g_answer;
+    }
+}
+
+static void OnDone(uint8_t peerCanAddr, IsoTpTransactResult result, uint16_t responseSize, void* arg) {
+    Outcome* outcome = static_cast<Outcome*>(arg);
+
+    CHECK(2 == peerCanAddr);
+    ++outcome->calls;
+    outcome->result = result;
+    outcome->size = responseSize;
+    outcome->timeUs = g_nowUs;
+}
+
+/* messages the manager received outside of a transaction */
+static int g_strayEvents;
+
+static void OnManagerEvent(IsoTpLink*, IsoTpEventTypes event, int, void*) {
+    g_strayEvents += ISOTP_EVENT_RECEIVE_COMPLETE == event ? 1 : 0;
+}
+
+template <typename Manager>
+static void Pump(Manager& manager, const Outcome& outcome, int steps = 100000) {
+    for (int step = 0; step < steps && 0 == outcome.calls; ++step) {
+        Deliver();
+        manager.Poll();
+        isotp_poll(&g_peer);
+        if (g_replyDue && ISOTP_SEND_STATUS_IDLE == g_peer.send_status) {
+            g_replyDue = false;
+            CHECK(1 == isotp_send(&g_peer, g_pattern.data(), g_responseSize));
+        }
+        g_nowUs += 10;
+    }
+}
+
+int main() {
+    static uint8_t sendBuf[4095], receiveBuf[4095], peerSendBuf[4095], peerReceiveBuf[4095];
+    CanLinkManager manager(uint8_t(1), uint8_t(2));
+    IsoTpLink& link = manager.GetIsotpLinks()[0];
+    uint8_t request[100], response[4095];
+
+    isotp_config_sendbuf(&link, sendBuf, 1000);
+    isotp_config_rcvbuf(&link, receiveBuf, sizeof(receiveBuf));
+    isotp_init_link(&g_peer, link.receive_arbitration_id, link.send_arbitration_id);
+    isotp_config_sendbuf(&g_peer, peerSendBuf, sizeof(peerSendBuf));
+    isotp_config_rcvbuf(&g_peer, peerReceiveBuf, sizeof(peerReceiveBuf));
+    isotp_config_event_cb(&g_peer, OnPeerEvent, nullptr);
+    link.user_send_can_arg = &g_peer;
+    g_peer.user_send_can_arg = &link;
+    manager.SetEventCallback(OnManagerEvent, nullptr);
+    for (std::size_t i = 0; i < g_pattern.size(); ++i) {
+        g_pattern[i] = static_cast<uint8_t>(i * 7);
+    }
+    std::memset(request, 0x22, sizeof(request));
+    ResetBus();
+
+    /* multi-frame request and response */
+    Outcome ok = {};
+    g_responseSize = 300;
+    CHECK(!manager.Transact(9, request, sizeof(request), response, sizeof(response), g_nowUs + 100000, OnDone, &ok));
+    CHECK(manager.Transact(2, request, sizeof(request), response, sizeof(response), g_nowUs + 100000, OnDone, &ok));
+    CHECK(!manager.Transact(2, request, sizeof(request), response, sizeof(response), g_nowUs + 100000, OnDone, &ok));
+    Pump(manager, ok);
+    CHECK(1 == ok.calls && IsoTpTransactResult::Ok == ok.result);
+    CHECK(300 == ok.size && 0 == std::memcmp(response, g_pattern.data(), 300));
+
+    /* a response larger than the buffer is cut to it */
+    Outcome tooLarge = {};
+    CHECK(manager.Transact(2, request, 5, response, 10, g_nowUs + 100000, OnDone, &tooLarge));
+    Pump(manager, tooLarge);
+    CHECK(1 == tooLarge.calls && IsoTpTransactResult::ResponseTooLarge == tooLarge.result);
+    CHECK(10 == tooLarge.size && 0 == std::memcmp(response, g_pattern.data(), 10));
+
+    /* no answer: completes once the deadline passed, not before */
+    Outcome timeout = {};
+    uint32_t deadline = g_nowUs + 30000;
+    g_answer = false;
+    CHECK(manager.Transact(2, request, sizeof(request), response, sizeof(response), deadline, OnDone, &timeout));
+    Pump(manager, timeout);
+    CHECK(1 == timeout.calls && IsoTpTransactResult::Timeout == timeout.result && 0 == timeout.size);
+    CHECK(IsoTpTimeAfter(timeout.timeUs, deadline) && timeout.timeUs <= deadline + 20);
+    g_answer = true;
+
+    /* a request too large for the send buffer fails within Transact, one without
+     * flow control from the peer when N_Bs expires
+     */
+    Outcome tooLong = {};
+    CHECK(manager.Transact(2, g_pattern.data(), 2000, response, sizeof(response), g_nowUs + 100000, OnDone, &tooLong));
+    CHECK(1 == tooLong.calls && IsoTpTransactResult::SendFailed == tooLong.result);
+    Outcome noFlowControl = {};
+    link.user_send_can_arg = nullptr;
+    CHECK(manager.Transact(2, request, sizeof(request), response, sizeof(response), g_nowUs + 1000000, OnDone, &noFlowControl));
+    Pump(manager, noFlowControl);
+    CHECK(1 == noFlowControl.calls && IsoTpTransactResult::SendFailed == noFlowControl.result);
+    link.user_send_can_arg = &g_peer;
+    /* the link is idle again after the next poll */
+    Pump(manager, Outcome(), 1);
+
+    /* the driver refuses the request, and a stray message of the peer arrives before
+     * the request went out: it is not the response
+     */
+    Outcome stray = {};
+    const uint8_t strayMessage[] = {0x7F, 0x01};
+    g_responseSize = 20;
+    g_refuseSends = 1;
+    g_refuseTo = &g_peer;
+    CHECK(manager.Transact(2, request, 5, response, sizeof(response), g_nowUs + 100000, OnDone, &stray));
+    CHECK(g_bus.empty() && ISOTP_SEND_STATUS_INPROGRESS == link.send_status);
+    CHECK(1 == isotp_send(&g_peer, strayMessage, sizeof(strayMessage)));
+    Deliver();
+    CHECK(0 == stray.calls && 1 == g_strayEvents);
+    Pump(manager, stray);
+    CHECK(1 == stray.calls && IsoTpTransactResult::Ok == stray.result);
+    CHECK(20 == stray.size && 0 == std::memcmp(response, g_pattern.data(), 20));
+
+    /* the callbacks ran once each, nothing comes later */
+    Pump(manager, Outcome(), 20000);
+    CHECK(1 == ok.calls && 1 == tooLarge.calls && 1 == timeout.calls && 1 == stray.calls);
+    CHECK(1 == tooLong.calls && 1 == noFlowControl.calls && 1 == g_strayEvents);
+
+    return Report("test_transact");
+}
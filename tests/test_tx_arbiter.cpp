@@ -0,0 +1,184 @@
+#include <cstring>
+#include <vector>
+#include "test_bus.hpp"
+#include "can_link_manager.hpp"
+
+using namespace isotp_test;
+
+static constexpr int k_peers = 3;
+static constexpr uint32_t k_stepUs = 10;
+
+static IsoTpLink g_peers[k_peers];
+static uint8_t g_message[1000];
+
+/* a frame the manager put on the bus */
+struct Sent {
+    int peer;
+    uint32_t timeUs;
+    uint8_t len;
+};
+static std::vector<Sent> g_sent;
+
+/* the bit time the manager accounts per frame */
+static uint32_t FrameBits(uint8_t size) {
+    return 47 + 8u * size + (34 + 8u * size - 1) / 4;
+}
+
+/* Polls the manager, records its frames and hands them to the peers, one step of the clock */
+template <typename Manager>
+static void Step(Manager& manager) {
+    manager.Poll();
+    while (!g_bus.empty()) {
+        Frame frame = g_bus.front();
+        g_bus.pop_front();
+        for (int i = 0; i < k_peers; ++i) {
+            if (frame.dst == &g_peers[i]) {
+                g_sent.push_back({i, g_nowUs, frame.len});
+            }
+        }
+        isotp_on_can_message(frame.dst, frame.data, frame.len);
+    }
+    for (auto& peer : g_peers) {
+        isotp_poll(&peer);
+    }
+    g_nowUs += k_stepUs;
+}
+
+/* Steps until no link of the manager sends.
+ * Return the number of steps taken
+ */
+template <typename Manager>
+static int Drain(Manager& manager) {
+    int step = 0;
+
+    for (; step < 1000000; ++step) {
+        bool sending = false;
+        for (auto& link : manager.GetIsotpLinks()) {
+            sending = sending || ISOTP_SEND_STATUS_INPROGRESS == link.send_status;
+        }
+        if (!sending && g_bus.empty()) {
+            break;
+        }
+        Step(manager);
+    }
+    return step;
+}
+
+/* every peer got the message once */
+static void CheckReceived(int peers) {
+    uint8_t out[4095];
+    uint16_t outSize;
+
+    for (int i = 0; i < peers; ++i) {
+        CHECK(ISOTP_RET_OK == isotp_receive(&g_peers[i], out, sizeof(out), &outSize));
+        CHECK(sizeof(g_message) == outSize && 0 == std::memcmp(out, g_message, outSize));
+    }
+}
+
+/* frames of peer sent before the last frame of other */
+static long FramesBeforeDone(int peer, int other) {
+    long count = 0, before = 0;
+
+    for (const Sent& sent : g_sent) {
+        if (sent.peer == peer) {
+            ++count;
+        } else if (sent.peer == other) {
+            before = count;
+        }
+    }
+    return before;
+}
+
+int main() {
+    static uint8_t sendBuf[k_peers][4095], receiveBuf[k_peers][4095];
+    static uint8_t peerSendBuf[k_peers][4095], peerReceiveBuf[k_peers][4095];
+    CanLinkManager manager(uint8_t(1), uint8_t(2), uint8_t(3), uint8_t(4));
+    IsoTpLink* links[k_peers];
+
+    for (int i = 0; i < k_peers; ++i) {
+        links[i] = &manager.GetIsotpLinks()[i];
+        isotp_config_sendbuf(links[i], sendBuf[i], sizeof(sendBuf[i]));
+        isotp_config_rcvbuf(links[i], receiveBuf[i], sizeof(receiveBuf[i]));
+        isotp_init_link(&g_peers[i], links[i]->receive_arbitration_id, links[i]->send_arbitration_id);
+        isotp_config_sendbuf(&g_peers[i], peerSendBuf[i], sizeof(peerSendBuf[i]));
+        isotp_config_rcvbuf(&g_peers[i], peerReceiveBuf[i], sizeof(peerReceiveBuf[i]));
+        links[i]->user_send_can_arg = &g_peers[i];
+        g_peers[i].user_send_can_arg = links[i];
+    }
+    for (std::size_t i = 0; i < sizeof(g_message); ++i) {
+        g_message[i] = static_cast<uint8_t>(i * 7);
+    }
+    ResetBus();
+
+    /* the bus load limit makes the bus the bottleneck, a frame about every 130 us */
+    CHECK(!manager.SetTxPriority(9, 0));
+    CHECK(!manager.SetTxPriority(2, 0, 0));
+    manager.EnableTxArbiter(true);
+    manager.SetBusLoadLimit(1000000, 300);
+
+    /* the higher class drains first, whichever link started first */
+    CHECK(manager.SetTxPriority(2, 1));
+    CHECK(manager.SetTxPriority(3, 0));
+    g_sent.clear();
+    CHECK(1 == manager.Send(2, g_message, sizeof(g_message)));
+    CHECK(1 == manager.Send(3, g_message, sizeof(g_message)));
+    CHECK(g_bus.empty());
+    Drain(manager);
+    CheckReceived(2);
+    long lowBeforeHigh = FramesBeforeDone(0, 1);
+    std::printf("priority: %ld frames of the lower class before the higher one completed\n", lowBeforeHigh);
+    CHECK(lowBeforeHigh <= 2);
+
+    /* equal priority: frames in proportion to the quanta while all links send,
+     * quanta up to the block size of the peers' flow control
+     */
+    CHECK(manager.SetTxPriority(2, 0, 1));
+    CHECK(manager.SetTxPriority(3, 0, 1));
+    CHECK(manager.SetTxPriority(4, 0, ISO_TP_DEFAULT_BLOCK_SIZE));
+    g_sent.clear();
+    for (uint8_t peer = 2; peer <= 4; ++peer) {
+        CHECK(1 == manager.Send(peer, g_message, sizeof(g_message)));
+    }
+    Drain(manager);
+    CheckReceived(3);
+    long share[k_peers] = {0, 0, 0};
+    for (const Sent& sent : g_sent) {
+        if (static_cast<long>(ISOTP_ENCODED_FRAME_COUNT(sizeof(g_message))) == share[2]) {
+            break;
+        }
+        ++share[sent.peer];
+    }
+    std::printf("quanta 1:1:%d: %ld:%ld:%ld frames\n", ISO_TP_DEFAULT_BLOCK_SIZE, share[0], share[1], share[2]);
+    CHECK(share[0] >= share[1] - 1 && share[0] <= share[1] + 1);
+    CHECK(share[2] >= ISO_TP_DEFAULT_BLOCK_SIZE * share[0] - 6 && share[2] <= ISO_TP_DEFAULT_BLOCK_SIZE * share[0] + 6);
+
+    /* any window of virtual time carries at most its share of the rate plus the burst */
+    long overLimit = 0;
+    for (std::size_t first = 0; first < g_sent.size(); ++first) {
+        uint64_t bits = 0;
+        for (std::size_t last = first; last < g_sent.size(); ++last) {
+            bits += FrameBits(g_sent[last].len);
+            uint64_t allowed = 300 + (static_cast<uint64_t>(g_sent[last].timeUs - g_sent[first].timeUs) * 1000000 + 999999) / 1000000;
+            overLimit += bits > allowed ? 1 : 0;
+        }
+    }
+    CHECK(0 == overLimit);
+    std::printf("bus load: %zu frames in %u us\n", g_sent.size(), static_cast<unsigned>(g_sent.back().timeUs - g_sent.front().timeUs));
+
+    /* without the arbiter frames go out when due, unaffected by the limit */
+    manager.EnableTxArbiter(false);
+    g_sent.clear();
+    CHECK(1 == manager.Send(2, g_message, 5));
+    CHECK(1 == g_bus.size());
+    Drain(manager);
+    uint8_t out[8];
+    uint16_t outSize;
+    CHECK(ISOTP_RET_OK == isotp_receive(&g_peers[0], out, sizeof(out), &outSize) && 5 == outSize);
+    CHECK(1 == manager.Send(2, g_message, sizeof(g_message)));
+    int steps = Drain(manager);
+    CheckReceived(1);
+    std::printf("arbiter disabled: %d steps for %d frames\n", steps, static_cast<int>(ISOTP_ENCODED_FRAME_COUNT(sizeof(g_message))));
+    CHECK(steps < 2 * static_cast<int>(ISOTP_ENCODED_FRAME_COUNT(sizeof(g_message))));
+
+    return Report("test_tx_arbiter");
+}
@@ -0,0 +1,103 @@
+#include <cstring>
+#include "test_bus.hpp"
+
+using namespace isotp_test;
+
+static int g_events[4];
+static int g_lastResult;
+
+static void OnEvent(IsoTpLink*, IsoTpEventTypes event, int protocolResult, void*) {
+    ++g_events[event];
+    g_lastResult = protocolResult;
+}
+
+static uint8_t g_message[1000];
+
+/* single and first frames refused with ISOTP_RET_NOSPACE go out with the transmit confirmation */
+static void TestNoSpace() {
+    static uint8_t aSend[4095], aReceive[4095], bSend[4095], bReceive[4095];
+    IsoTpLink a, b;
+    uint8_t out[4095];
+    uint16_t outSize;
+
+    ResetBus();
+    std::memset(g_events, 0, sizeof(g_events));
+    ConnectLinks(&a, &b, aSend, aReceive, bSend, bReceive, sizeof(aSend));
+    isotp_config_event_cb(&a, OnEvent, nullptr);
+
+    /* single frame */
+    g_refuseSends = 1;
+    CHECK(1 == isotp_send(&a, g_message, 5));
+    CHECK(ISOTP_SEND_STATUS_INPROGRESS == a.send_status && g_bus.empty());
+    CHECK(0 == isotp_on_tx_complete(&a));
+    CHECK(1 == g_events[ISOTP_EVENT_SEND_COMPLETE] && 1 == g_bus.size());
+    Deliver();
+    CHECK(ISOTP_RET_OK == isotp_receive(&b, out, sizeof(out), &outSize));
+    CHECK(5 == outSize && 0 == std::memcmp(out, g_message, 5));
+
+    /* first frame, then the whole message driven by transmit confirmations only */
+    g_refuseSends = 1;
+    CHECK(1 == isotp_send(&a, g_message, sizeof(g_message)));
+    CHECK(g_bus.empty());
+    for (int i = 0; i < 10000 && ISOTP_SEND_STATUS_INPROGRESS == a.send_status; ++i) {
+        isotp_on_tx_complete(&a);
+        Deliver();
+    }
+    CHECK(2 == g_events[ISOTP_EVENT_SEND_COMPLETE]);
+    CHECK(ISOTP_RET_OK == isotp_receive(&b, out, sizeof(out), &outSize));
+    CHECK(sizeof(g_message) == outSize && 0 == std::memcmp(out, g_message, outSize));
+
+    /* a frame the driver never takes fails with N_As */
+    g_refuseSends = 1000000;
+    CHECK(1 == isotp_send(&a, g_message, 5));
+    for (int i = 0; i < 20000 && ISOTP_SEND_STATUS_INPROGRESS == a.send_status; ++i) {
+        isotp_poll(&a);
+        g_nowUs += 10;
+    }
+    CHECK(1 == g_events[ISOTP_EVENT_SEND_ERROR] && ISOTP_PROTOCOL_RESULT_TIMEOUT_A == g_lastResult);
+    ResetBus();
+}
+
+/* the interrupt side only flags the link, the task sends */
+static void TestConfirmationFromIsr() {
+    static uint8_t aSend[4095], aReceive[4095], bSend[4095], bReceive[4095];
+    IsoTpLink a, b;
+    uint8_t out[4095];
+    uint16_t outSize;
+
+    ResetBus();
+    ConnectLinks(&a, &b, aSend, aReceive, bSend, bReceive, sizeof(aSend));
+
+    /* refused by the send and by the retry of the poll */
+    g_refuseSends = 2;
+    CHECK(1 == isotp_send(&a, g_message, 5));
+    CHECK(isotp_poll_us(&a) > 0);
+    CHECK(g_bus.empty());
+
+    isotp_on_tx_complete_isr(&a);
+    CHECK(0 != a.tx_complete_pending && g_bus.empty());
+    isotp_poll(&a);
+    CHECK(0 == a.tx_complete_pending && 1 == g_bus.size() && ISOTP_SEND_STATUS_IDLE == a.send_status);
+    Deliver();
+    CHECK(ISOTP_RET_OK == isotp_receive(&b, out, sizeof(out), &outSize) && 5 == outSize);
+
+    /* isotp_on_tx_complete in the task takes the flag as well */
+    CHECK(1 == isotp_send(&a, g_message, sizeof(g_message)));
+    Deliver();
+    isotp_on_tx_complete_isr(&a);
+    CHECK(0 != a.tx_complete_pending);
+    isotp_on_tx_complete(&a);
+    CHECK(0 == a.tx_complete_pending);
+    Run({&a, &b});
+    CHECK(ISOTP_RET_OK == isotp_receive(&b, out, sizeof(out), &outSize));
+    CHECK(sizeof(g_message) == outSize && 0 == std::memcmp(out, g_message, outSize));
+}
+
+int main() {
+    for (std::size_t i = 0; i < sizeof(g_message); ++i) {
+        g_message[i] = static_cast<uint8_t>(i);
+    }
+    TestNoSpace();
+    TestConfirmationFromIsr();
+    return Report("test_tx_complete");
+}
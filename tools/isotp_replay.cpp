@@ -0,0 +1,428 @@
+/* Replays a candump log through the ISO-TP engine.
+ *
+ * Every ISO-TP frame of the trace (bit 10 set in a standard ID, see CanLinkManager) is
+ * handed to the link of its receiver node, one CanLinkManager per receiver address with
+ * links to all 32 sender addresses. The engine's clock is a virtual clock following the
+ * trace timestamps, so timeouts and stalls replay exactly as recorded, whether the trace
+ * runs in real time or as fast as possible. The links are polled with isotp_poll_us at the
+ * deadlines they report, between frames if needed. The engine's own flow control frames are
+ * counted and dropped, the recorded flow control frames of the real receivers drive
+ * nothing since the replaying links never send.
+ *
+ * Usage: isotp_replay [--realtime] [--node ADDR] [--print] [--verbose] <trace.log | ->
+ *
+ * Accepted line formats, as written by candump -l and candump -ta:
+ *   (1600000000.123456) can0 6A1#1014DEADBEEF0102
+ *   (1600000000.123456)  can0  6A1   [8]  10 14 DE AD BE EF 01 02
+ */
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "can_link_manager.hpp"
+
+namespace {
+
+constexpr std::size_t k_numAddrs = 32;
+constexpr uint16_t k_rcvBufSize = 4095;
+constexpr uint16_t k_sendBufSize = 8;
+
+/* virtual clock, microseconds since the first frame of the trace, wraps like a hardware timer */
+uint32_t g_virtualUs = 0;
+bool g_verbose = false;
+
+template <std::size_t... I>
+auto MakeNodeManager(uint8_t node, std::index_sequence<I...>) {
+    using Manager = CanLinkManager<decltype(static_cast<uint8_t>(I))...>;
+    return std::make_unique<Manager>(node, static_cast<uint8_t>(I)...);
+}
+
+using NodeManager = decltype(MakeNodeManager(0, std::make_index_sequence<k_numAddrs>{}))::element_type;
+
+struct TraceFrame {
+    uint64_t timestampUs;
+    uint32_t id;
+    uint8_t len;
+    uint8_t data[8];
+};
+
+struct Stats {
+    uint64_t lines = 0;
+    uint64_t skippedLines = 0;
+    uint64_t frames = 0;
+    uint64_t isotpFrames = 0;
+    uint64_t otherFrames = 0;
+    uint64_t engineFrames = 0;
+    uint64_t messages = 0;
+    uint64_t messageBytes = 0;
+    uint64_t incomplete = 0;
+    std::array<uint64_t, 10> errors{}; /* by -ISOTP_PROTOCOL_RESULT_* */
+};
+
+Stats g_stats;
+bool g_printMessages = false;
+
+const char* ProtocolResultName(int result) {
+    switch (result) {
+        case ISOTP_PROTOCOL_RESULT_TIMEOUT_A:    return "timeout A";
+        case ISOTP_PROTOCOL_RESULT_TIMEOUT_BS:   return "timeout Bs";
+        case ISOTP_PROTOCOL_RESULT_TIMEOUT_CR:   return "timeout Cr";
+        case ISOTP_PROTOCOL_RESULT_WRONG_SN:     return "wrong SN";
+        case ISOTP_PROTOCOL_RESULT_INVALID_FS:   return "invalid FS";
+        case ISOTP_PROTOCOL_RESULT_UNEXP_PDU:    return "unexpected PDU";
+        case ISOTP_PROTOCOL_RESULT_WFT_OVRN:     return "wait overrun";
+        case ISOTP_PROTOCOL_RESULT_BUFFER_OVFLW: return "buffer overflow";
+        default:                                 return "error";
+    }
+}
+
+/* One manager per receiver node, created on its first frame */
+class Replayer {
+private:
+    std::array<std::unique_ptr<NodeManager>, k_numAddrs> managers_;
+    std::array<std::vector<uint8_t>, k_numAddrs> buffers_;
+    std::vector<uint8_t> message_ = std::vector<uint8_t>(k_rcvBufSize);
+    /* earliest time any link needs to be polled */
+    bool hasDeadline_ = false;
+    uint32_t nextDeadline_ = 0;
+
+public:
+    NodeManager& GetManager(uint8_t node) {
+        if (!managers_[node]) {
+            managers_[node] = MakeNodeManager(node, std::make_index_sequence<k_numAddrs>{});
+            buffers_[node].resize(k_numAddrs * (k_rcvBufSize + k_sendBufSize));
+
+            uint8_t* buffer = buffers_[node].data();
+            for (auto& link : managers_[node]->GetIsotpLinks()) {
+                isotp_config_rcvbuf(&link, buffer, k_rcvBufSize);
+                isotp_config_sendbuf(&link, buffer + k_rcvBufSize, k_sendBufSize);
+                buffer += k_rcvBufSize + k_sendBufSize;
+            }
+            managers_[node]->SetEventCallback(&Replayer::OnEvent, this);
+        }
+        return *managers_[node];
+    }
+
+    void OnFrame(const TraceFrame& frame) {
+        uint8_t receiver = frame.id & (k_numAddrs - 1);
+        NodeManager& manager = GetManager(receiver);
+        IsoTpLink* link = manager.GetLinkFromReceiveCanId(static_cast<uint16_t>(frame.id));
+
+        isotp_on_can_message(link, frame.data, frame.len);
+        /* a frame only restarts timers of its own link, so the earliest deadline is kept up to date cheaply */
+        AddDeadline(isotp_poll_us(link));
+    }
+
+    /* Polls all links at the earliest deadline as long as it is not after untilUs */
+    void PollUntil(uint32_t untilUs) {
+        while (hasDeadline_ && !IsoTpTimeAfter(nextDeadline_, untilUs)) {
+            g_virtualUs = nextDeadline_;
+            hasDeadline_ = false;
+            for (auto& manager : managers_) {
+                if (!manager) {
+                    continue;
+                }
+                for (auto& link : manager->GetIsotpLinks()) {
+                    AddDeadline(isotp_poll_us(&link));
+                }
+            }
+        }
+    }
+
+    /* messages still being received when the trace ends */
+    uint64_t CountIncomplete() {
+        uint64_t count = 0;
+
+        for (auto& manager : managers_) {
+            if (!manager) {
+                continue;
+            }
+            for (auto& link : manager->GetIsotpLinks()) {
+                count += ISOTP_RECEIVE_STATUS_INPROGRESS == link.receive_status;
+            }
+        }
+        return count;
+    }
+
+private:
+    void AddDeadline(uint32_t pollUs) {
+        if (ISOTP_NO_DEADLINE == pollUs) {
+            return;
+        }
+        /* 0 asks for another poll right away, at the next microsecond keeps the clock moving */
+        uint32_t deadline = g_virtualUs + (0 == pollUs ? 1 : pollUs);
+        if (!hasDeadline_ || IsoTpTimeAfter(nextDeadline_, deadline)) {
+            nextDeadline_ = deadline;
+            hasDeadline_ = true;
+        }
+    }
+
+    static void OnEvent(IsoTpLink* link, IsoTpEventTypes event, int protocolResult, void* arg) {
+        static_cast<Replayer*>(arg)->HandleEvent(link, event, protocolResult);
+    }
+
+    void HandleEvent(IsoTpLink* link, IsoTpEventTypes event, int protocolResult) {
+        unsigned sender = (link->receive_arbitration_id >> 5) & (k_numAddrs - 1);
+        unsigned receiver = link->receive_arbitration_id & (k_numAddrs - 1);
+
+        if (ISOTP_EVENT_RECEIVE_COMPLETE == event) {
+            uint16_t size = 0;
+
+            if (ISOTP_RET_OK != isotp_receive(link, message_.data(), k_rcvBufSize, &size)) {
+                return;
+            }
+            ++g_stats.messages;
+            g_stats.messageBytes += size;
+            if (g_printMessages) {
+                std::printf("%10.6f  %02u -> %02u  [%4u] ", g_virtualUs / 1e6, sender, receiver, size);
+                for (uint16_t idx = 0; idx < size; ++idx) {
+                    std::printf(" %02X", message_[idx]);
+                }
+                std::printf("\n");
+            }
+        } else if (ISOTP_EVENT_RECEIVE_ERROR == event) {
+            std::size_t slot = protocolResult < 0 && -protocolResult < static_cast<int>(g_stats.errors.size())
+                               ? -protocolResult : -ISOTP_PROTOCOL_RESULT_ERROR;
+            ++g_stats.errors[slot];
+            if (g_verbose) {
+                std::printf("%10.6f  %02u -> %02u  %s\n", g_virtualUs / 1e6, sender, receiver,
+                            ProtocolResultName(protocolResult));
+            }
+        }
+    }
+};
+
+bool ParseHexByte(const char* text, uint8_t* value) {
+    char byteText[3] = {text[0], text[1], '\0'};
+    char* end;
+
+    if (!std::isxdigit(static_cast<unsigned char>(text[0])) || !std::isxdigit(static_cast<unsigned char>(text[1]))) {
+        return false;
+    }
+    *value = static_cast<uint8_t>(std::strtoul(byteText, &end, 16));
+    return end == byteText + 2;
+}
+
+/* Return false for lines that are no classic CAN data frames */
+bool ParseLine(const std::string& line, TraceFrame* frame) {
+    const char* text = line.c_str();
+    unsigned long long seconds;
+    char fraction[16];
+    char iface[32];
+    int consumed = 0;
+
+    if (std::sscanf(text, " (%llu.%15[0-9]) %31s %n", &seconds, fraction, iface, &consumed) < 3 || 0 == consumed) {
+        return false;
+    }
+
+    /* microseconds from the fraction, whatever its number of digits */
+    uint64_t micros = 0;
+    std::size_t digits = std::strlen(fraction);
+    for (std::size_t idx = 0; idx < 6; ++idx) {
+        micros = micros * 10 + (idx < digits ? fraction[idx] - '0' : 0);
+    }
+    frame->timestampUs = seconds * 1000000ull + micros;
+
+    const char* cursor = text + consumed;
+    char* end;
+    frame->id = static_cast<uint32_t>(std::strtoul(cursor, &end, 16));
+    std::size_t idDigits = static_cast<std::size_t>(end - cursor);
+    if (0 == idDigits || idDigits > 8) {
+        return false;
+    }
+    /* extended IDs are written with 8 digits */
+    if (idDigits > 3) {
+        frame->id |= 0x80000000u;
+    }
+    cursor = end;
+
+    frame->len = 0;
+    if ('#' == *cursor) {
+        /* candump -l: ID#DATA, CAN FD (##) and remote frames (#R) are skipped */
+        ++cursor;
+        if ('#' == *cursor || 'R' == *cursor || 'r' == *cursor) {
+            return false;
+        }
+        uint8_t value;
+        while (ParseHexByte(cursor, &value)) {
+            if (8 == frame->len) {
+                return false;
+            }
+            frame->data[frame->len++] = value;
+            cursor += 2;
+        }
+    } else {
+        /* candump -ta: ID [LEN] HH HH ... */
+        unsigned len;
+        int dataStart = 0;
+        if (std::sscanf(cursor, " [%u] %n", &len, &dataStart) < 1 || 0 == dataStart || len > 8) {
+            return false;
+        }
+        cursor += dataStart;
+        for (frame->len = 0; frame->len < len; ++frame->len) {
+            while (' ' == *cursor) {
+                ++cursor;
+            }
+            if (!ParseHexByte(cursor, &frame->data[frame->len])) {
+                return false;
+            }
+            cursor += 2;
+        }
+    }
+    return true;
+}
+
+int Usage(const char* program) {
+    std::fprintf(stderr,
+                 "Usage: %s [--realtime] [--node ADDR] [--print] [--verbose] <trace.log | ->\n"
+                 "  --realtime   pace the replay by the trace timestamps, default is as fast as possible\n"
+                 "  --node ADDR  only replay the frames received by node ADDR (0-31)\n"
+                 "  --print      print every reassembled message\n"
+                 "  --verbose    print every protocol error\n",
+                 program);
+    return 2;
+}
+
+} // namespace
+
+extern "C" {
+
+void isotp_user_debug(const char* message, ...) {
+    if (g_verbose) {
+        va_list args;
+        va_start(args, message);
+        std::vfprintf(stderr, message, args);
+        va_end(args);
+    }
+}
+
+/* the engine's flow control frames are not sent anywhere */
+int isotp_user_send_can(const uint32_t, const uint8_t*, const uint8_t
+#if defined (ISO_TP_USER_SEND_CAN_ARG)
+, void*
+#endif
+) {
+    ++g_stats.engineFrames;
+    return ISOTP_RET_OK;
+}
+
+uint32_t isotp_user_get_us(void) {
+    return g_virtualUs;
+}
+
+} // extern "C"
+
+int main(int argc, char** argv) {
+    bool realtime = false;
+    int onlyNode = -1;
+    const char* path = nullptr;
+
+    for (int idx = 1; idx < argc; ++idx) {
+        std::string arg = argv[idx];
+        if ("--realtime" == arg) {
+            realtime = true;
+        } else if ("--node" == arg && idx + 1 < argc) {
+            onlyNode = std::atoi(argv[++idx]);
+            if (onlyNode < 0 || onlyNode >= static_cast<int>(k_numAddrs)) {
+                return Usage(argv[0]);
+            }
+        } else if ("--print" == arg) {
+            g_printMessages = true;
+        } else if ("--verbose" == arg) {
+            g_verbose = true;
+        } else if (nullptr == path && (arg.empty() || '-' != arg[0] || "-" == arg)) {
+            path = argv[idx];
+        } else {
+            return Usage(argv[0]);
+        }
+    }
+    if (nullptr == path) {
+        return Usage(argv[0]);
+    }
+
+    std::ifstream file;
+    if (0 != std::strcmp(path, "-")) {
+        file.open(path);
+        if (!file) {
+            std::fprintf(stderr, "cannot open %s\n", path);
+            return 1;
+        }
+    }
+    std::istream& input = file.is_open() ? static_cast<std::istream&>(file) : std::cin;
+
+    Replayer replayer;
+    TraceFrame frame;
+    std::string line;
+    bool first = true;
+    uint64_t traceStartUs = 0;
+    uint64_t traceEndUs = 0;
+    auto wallStart = std::chrono::steady_clock::now();
+
+    while (std::getline(input, line)) {
+        ++g_stats.lines;
+        if (!ParseLine(line, &frame)) {
+            ++g_stats.skippedLines;
+            continue;
+        }
+        ++g_stats.frames;
+        if (first) {
+            traceStartUs = frame.timestampUs;
+            first = false;
+        }
+
+        traceEndUs = frame.timestampUs;
+
+        /* advance the virtual clock, timeouts expire at their recorded time and not at the next frame */
+        uint32_t frameUs = static_cast<uint32_t>(frame.timestampUs - traceStartUs);
+        replayer.PollUntil(frameUs);
+        g_virtualUs = frameUs;
+
+        if (realtime) {
+            std::this_thread::sleep_until(wallStart + std::chrono::microseconds(frame.timestampUs - traceStartUs));
+        }
+
+        /* ISO-TP frames carry bit 10 in a standard ID */
+        if ((frame.id & 0x80000000u) || (frame.id >> 10) != 1 ||
+            (onlyNode >= 0 && static_cast<uint32_t>(onlyNode) != (frame.id & (k_numAddrs - 1)))) {
+            ++g_stats.otherFrames;
+            continue;
+        }
+        ++g_stats.isotpFrames;
+        replayer.OnFrame(frame);
+    }
+
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    g_stats.incomplete = replayer.CountIncomplete();
+
+    std::printf("trace:     %" PRIu64 " lines, %" PRIu64 " skipped, %.6f s\n",
+                g_stats.lines, g_stats.skippedLines, (traceEndUs - traceStartUs) / 1e6);
+    std::printf("frames:    %" PRIu64 " (%" PRIu64 " ISO-TP, %" PRIu64 " other), %" PRIu64 " flow control generated\n",
+                g_stats.frames, g_stats.isotpFrames, g_stats.otherFrames, g_stats.engineFrames);
+    std::printf("messages:  %" PRIu64 " reassembled, %" PRIu64 " bytes, %" PRIu64 " incomplete at end of trace\n",
+                g_stats.messages, g_stats.messageBytes, g_stats.incomplete);
+
+    uint64_t totalErrors = 0;
+    for (auto count : g_stats.errors) {
+        totalErrors += count;
+    }
+    std::printf("errors:    %" PRIu64 "\n", totalErrors);
+    for (std::size_t idx = 1; idx < g_stats.errors.size(); ++idx) {
+        if (0 != g_stats.errors[idx]) {
+            std::printf("  %-16s %" PRIu64 "\n", ProtocolResultName(-static_cast<int>(idx)), g_stats.errors[idx]);
+        }
+    }
+    std::printf("wall time: %.6f s, %.0f frames/s\n", wallSeconds,
+                wallSeconds > 0 ? g_stats.frames / wallSeconds : 0.0);
+    return 0;
+}